@@ -0,0 +1,103 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "benchmark.h"
+#include "logging.h"
+#include "mesh.h"
+#include "platform.h"
+
+void init_samples(BenchmarkSamples* out)
+{
+    out->values = NULL;
+    out->numValues = 0;
+    out->capacity = 0;
+}
+
+void benchmark_init(Benchmark* out)
+{
+    out->startTime = platform_get_time();
+    init_samples(&out->frameTimes);
+    init_samples(&out->chunkLatencies);
+    init_samples(&out->drawCalls);
+    init_samples(&out->draws);
+    init_samples(&out->triangles);
+}
+
+void benchmark_destroy(Benchmark* benchmark)
+{
+    free(benchmark->frameTimes.values);
+    free(benchmark->chunkLatencies.values);
+    free(benchmark->drawCalls.values);
+    free(benchmark->draws.values);
+    free(benchmark->triangles.values);
+    init_samples(&benchmark->frameTimes);
+    init_samples(&benchmark->chunkLatencies);
+    init_samples(&benchmark->drawCalls);
+    init_samples(&benchmark->draws);
+    init_samples(&benchmark->triangles);
+}
+
+void benchmark_add_sample(BenchmarkSamples* samples, double value)
+{
+    if (samples->numValues == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        samples->values = (double*)realloc(samples->values, sizeof(double) * samples->capacity);
+    }
+    samples->values[samples->numValues++] = value;
+}
+
+void benchmark_end_frame(Benchmark* benchmark, double frameTime)
+{
+    benchmark_add_sample(&benchmark->frameTimes, frameTime);
+    benchmark_add_sample(&benchmark->drawCalls, meshDrawStats.numDrawCalls);
+    benchmark_add_sample(&benchmark->draws, meshDrawStats.numDraws);
+    benchmark_add_sample(&benchmark->triangles, (double)meshDrawStats.numTriangles);
+    meshDrawStats.numDrawCalls = 0;
+    meshDrawStats.numDraws = 0;
+    meshDrawStats.numTriangles = 0;
+}
+
+int compare_samples(const void* a, const void* b)
+{
+    const double lhs = *(const double*)a;
+    const double rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Nearest rank, so every percentile is a value that was measured
+double get_percentile(const BenchmarkSamples* samples, double percentile)
+{
+    int rank = (int)ceil(percentile / 100.0 * samples->numValues);
+    return samples->values[rank > 0 ? rank - 1 : 0];
+}
+
+void log_samples(const char* name, BenchmarkSamples* samples, double scale)
+{
+    if (samples->numValues == 0)
+    {
+        LOG("  %-22s no samples", name);
+        return;
+    }
+
+    qsort(samples->values, (size_t)samples->numValues, sizeof(double), compare_samples);
+    double sum = 0.0;
+    for (int i = 0; i < samples->numValues; ++i)
+        sum += samples->values[i];
+
+    LOG("  %-22s mean %10.2f  p50 %10.2f  p90 %10.2f  p99 %10.2f  max %10.2f  (%d samples)", name,
+        sum / samples->numValues * scale, get_percentile(samples, 50.0) * scale, get_percentile(samples, 90.0) * scale,
+        get_percentile(samples, 99.0) * scale, samples->values[samples->numValues - 1] * scale, samples->numValues);
+}
+
+void benchmark_log_report(Benchmark* benchmark)
+{
+    const double duration = platform_get_time() - benchmark->startTime;
+    LOG("Benchmark: %d frames in %.2f s, %.1f fps", benchmark->frameTimes.numValues, duration,
+        duration > 0.0 ? benchmark->frameTimes.numValues / duration : 0.0);
+    log_samples("frame time (ms)", &benchmark->frameTimes, 1000.0);
+    log_samples("chunk latency (ms)", &benchmark->chunkLatencies, 1000.0);
+    log_samples("draw calls per frame", &benchmark->drawCalls, 1.0);
+    log_samples("draws per frame", &benchmark->draws, 1.0);
+    log_samples("triangles per frame", &benchmark->triangles, 1.0);
+}
@@ -0,0 +1,35 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Measurements taken over a benchmark run, logged at the end as their mean, percentiles and worst
+
+typedef struct BenchmarkSamples {
+    double* values;
+    int numValues;
+    int capacity;
+} BenchmarkSamples;
+
+typedef struct Benchmark {
+    double startTime;
+    BenchmarkSamples frameTimes; // seconds
+    BenchmarkSamples chunkLatencies; // seconds from a chunk's request to its upload
+    // Per frame, from meshDrawStats
+    BenchmarkSamples drawCalls;
+    BenchmarkSamples draws;
+    BenchmarkSamples triangles;
+} Benchmark;
+
+void benchmark_init(Benchmark* out);
+
+void benchmark_destroy(Benchmark* benchmark);
+
+void benchmark_add_sample(BenchmarkSamples* samples, double value);
+
+// Records the frame's time and what meshDrawStats counted during it, then resets meshDrawStats. Call
+// once per frame, after its last draw.
+void benchmark_end_frame(Benchmark* benchmark, double frameTime);
+
+// Sorts the samples in place
+void benchmark_log_report(Benchmark* benchmark);
+
+#endif
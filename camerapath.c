@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "camerapath.h"
+#include "macromagic.h"
+
+void camera_path_init(CameraPath* out, float stepRate)
+{
+    out->keys = NULL;
+    out->numKeys = 0;
+    out->capacity = 0;
+    out->stepRate = stepRate;
+}
+
+void camera_path_destroy(CameraPath* path)
+{
+    free(path->keys);
+    path->keys = NULL;
+    path->numKeys = 0;
+    path->capacity = 0;
+}
+
+void camera_path_add(CameraPath* path, const float* position, const float* forward)
+{
+    if (path->numKeys == path->capacity)
+    {
+        path->capacity = path->capacity ? path->capacity * 2 : 1024;
+        path->keys = (CameraPathKey*)realloc(path->keys, sizeof(CameraPathKey) * path->capacity);
+    }
+
+    CameraPathKey* key = &path->keys[path->numKeys++];
+    memcpy(key->position, position, sizeof(key->position));
+    memcpy(key->forward, forward, sizeof(key->forward));
+}
+
+int camera_path_save(const CameraPath* path, const char* filePath)
+{
+    FILE* file = fopen(filePath, "wb");
+    if (!file)
+        return FALSE;
+
+    CameraPathHeader header;
+    memcpy(header.magic, "CPT1", 4);
+    header.stepRate = path->stepRate;
+    header.numKeys = (unsigned int)path->numKeys;
+    int bIsSaved = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (path->numKeys == 0 || fwrite(path->keys, sizeof(CameraPathKey), (size_t)path->numKeys, file) == (size_t)path->numKeys);
+    return fclose(file) == 0 && bIsSaved;
+}
+
+int camera_path_load(CameraPath* out, const char* filePath)
+{
+    FILE* file = fopen(filePath, "rb");
+    if (!file)
+        return FALSE;
+
+    CameraPathHeader header;
+    int bIsLoaded = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "CPT1", 4) == 0;
+    if (bIsLoaded)
+    {
+        camera_path_init(out, header.stepRate);
+        out->capacity = (int)header.numKeys;
+        out->keys = (CameraPathKey*)malloc(sizeof(CameraPathKey) * (header.numKeys ? header.numKeys : 1));
+        bIsLoaded = fread(out->keys, sizeof(CameraPathKey), header.numKeys, file) == header.numKeys;
+        if (bIsLoaded)
+            out->numKeys = (int)header.numKeys;
+        else
+            camera_path_destroy(out);
+    }
+
+    fclose(file);
+    return bIsLoaded;
+}
@@ -0,0 +1,36 @@
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+// The camera at every fixed simulation step of a run, saved to a file so the same flight can be drawn
+// again. Files are a CameraPathHeader followed by the keys, in the writing machine's byte order.
+
+typedef struct CameraPathKey {
+    float position[3];
+    float forward[3];
+} CameraPathKey;
+
+typedef struct CameraPathHeader {
+    char magic[4];
+    float stepRate; // keys per second of the recorded run
+    unsigned int numKeys;
+} CameraPathHeader;
+
+typedef struct CameraPath {
+    CameraPathKey* keys;
+    int numKeys;
+    int capacity;
+    float stepRate;
+} CameraPath;
+
+void camera_path_init(CameraPath* out, float stepRate);
+
+void camera_path_destroy(CameraPath* path);
+
+void camera_path_add(CameraPath* path, const float* position, const float* forward);
+
+// Both return FALSE if the file could not be written or read, or is not a camera path
+int camera_path_save(const CameraPath* path, const char* filePath);
+
+int camera_path_load(CameraPath* out, const char* filePath);
+
+#endif
@@ -0,0 +1,227 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "cdlod.h"
+#include "glutils.h"
+#include "macromagic.h"
+#include "terrain.h"
+
+MeshVertexAttribute cdlodGridVertexAttributes[1] = {
+    { 2, GL_FLOAT, FALSE, FALSE }, // position within the node, [0, 1]
+};
+
+void cdlod_init(Cdlod* out, float lod0Range)
+{
+    const int rowVertices = CDLOD_GRID_SIZE + 1;
+
+    MeshData data;
+    data.vertexAttributes = cdlodGridVertexAttributes;
+    data.numVertexAttributes = 1;
+    data.numVertices = rowVertices * rowVertices;
+    data.numIndices = CDLOD_GRID_SIZE * CDLOD_GRID_SIZE * 6;
+    mesh_allocate_mesh_data(&data);
+
+    float* vv = data.vertices;
+    for (int vz = 0; vz < rowVertices; ++vz)
+        for (int vx = 0; vx < rowVertices; ++vx)
+        {
+            *vv++ = (float)vx / CDLOD_GRID_SIZE;
+            *vv++ = (float)vz / CDLOD_GRID_SIZE;
+        }
+
+    // Same diagonal as the terrain chunks. Morphing collapses each 2x2 block of quads onto one quad with
+    // that diagonal too, which is the next LOD's triangulation.
+    unsigned int* iv = data.indices;
+    for (int vz = 0; vz < CDLOD_GRID_SIZE; ++vz)
+        for (int vx = 0; vx < CDLOD_GRID_SIZE; ++vx)
+        {
+            int v0 = vz * rowVertices + vx;
+            int v1 = v0 + 1;
+            int v2 = v0 + rowVertices;
+            int v3 = v2 + 1;
+
+            *iv++ = v0;
+            *iv++ = v2;
+            *iv++ = v1;
+            *iv++ = v1;
+            *iv++ = v2;
+            *iv++ = v3;
+        }
+
+    mesh_create(&out->gridMesh, &data);
+    mesh_free_mesh_data(&data);
+
+    const int* permutation = terrain_get_noise_permutation();
+    unsigned char texels[512];
+    for (int i = 0; i < 512; ++i)
+        texels[i] = (unsigned char)permutation[i];
+
+    glGenTextures(1, &out->glPermutationTexture);
+    glBindTexture(GL_TEXTURE_2D, out->glPermutationTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, 512, 1, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, texels);
+
+    float previousRange = 0.0f;
+    for (int lod = 0; lod < CDLOD_NUM_LODS; ++lod)
+    {
+        out->lodRanges[lod] = lod0Range * (float)(1 << lod);
+        out->morphStarts[lod] = previousRange + (out->lodRanges[lod] - previousRange) * CDLOD_MORPH_START_RATIO;
+        previousRange = out->lodRanges[lod];
+    }
+
+    out->selectionCapacity = 256;
+    out->selection = (CdlodNode*)malloc(sizeof(CdlodNode) * out->selectionCapacity);
+    out->numSelected = 0;
+
+    out->boundsCache = (CdlodBoundsCacheEntry*)calloc(CDLOD_BOUNDS_CACHE_SIZE, sizeof(CdlodBoundsCacheEntry));
+}
+
+void cdlod_destroy(Cdlod* cdlod)
+{
+    mesh_destroy(&cdlod->gridMesh);
+    glDeleteTextures(1, &cdlod->glPermutationTexture);
+    free(cdlod->selection);
+    free(cdlod->boundsCache);
+}
+
+void get_node_bounds(Cdlod* cdlod, int lod, int x, int z, float* minHeight, float* maxHeight)
+{
+    const unsigned int hash = ((unsigned int)x * 73856093u) ^ ((unsigned int)z * 19349663u) ^ ((unsigned int)lod * 83492791u);
+    CdlodBoundsCacheEntry* entry = &cdlod->boundsCache[hash & (CDLOD_BOUNDS_CACHE_SIZE - 1)];
+
+    if (!entry->bIsValid || entry->lod != lod || entry->x != x || entry->z != z)
+    {
+        const float size = CDLOD_LEAF_SIZE * (float)(1 << lod);
+        terrain_sample_height_bounds(x * size, z * size, size, CDLOD_GRID_SIZE, &entry->minHeight, &entry->maxHeight);
+        entry->lod = lod;
+        entry->x = x;
+        entry->z = z;
+        entry->bIsValid = TRUE;
+    }
+
+    *minHeight = entry->minHeight;
+    *maxHeight = entry->maxHeight;
+}
+
+int sphere_intersects_box(const float* centre, float radius, const float* boxMin, const float* boxMax)
+{
+    float distanceSq = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        const float d = centre[i] < boxMin[i] ? boxMin[i] - centre[i] : (centre[i] > boxMax[i] ? centre[i] - boxMax[i] : 0.0f);
+        distanceSq += d * d;
+    }
+    return distanceSq <= radius * radius;
+}
+
+int box_outside_frustum(const float* frustumPlanes, const float* boxMin, const float* boxMax)
+{
+    for (int p = 0; p < 6; ++p)
+    {
+        const float* plane = &frustumPlanes[p * 4];
+
+        // The box corner furthest along the plane normal
+        const float x = plane[0] >= 0.0f ? boxMax[0] : boxMin[0];
+        const float y = plane[1] >= 0.0f ? boxMax[1] : boxMin[1];
+        const float z = plane[2] >= 0.0f ? boxMax[2] : boxMin[2];
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+void add_selected_node(Cdlod* cdlod, const CdlodNode* node)
+{
+    if (cdlod->numSelected == cdlod->selectionCapacity)
+    {
+        cdlod->selectionCapacity *= 2;
+        cdlod->selection = (CdlodNode*)realloc(cdlod->selection, sizeof(CdlodNode) * cdlod->selectionCapacity);
+    }
+    cdlod->selection[cdlod->numSelected++] = *node;
+}
+
+// Returns FALSE if the node is beyond its LOD's range, leaving its parent to cover the area
+int select_node(Cdlod* cdlod, const float* camera, const float* frustumPlanes, int lod, int x, int z)
+{
+    CdlodNode node;
+    node.size = CDLOD_LEAF_SIZE * (float)(1 << lod);
+    node.x = x * node.size;
+    node.z = z * node.size;
+    node.lod = lod;
+    get_node_bounds(cdlod, lod, x, z, &node.minHeight, &node.maxHeight);
+
+    const float boxMin[3] = { node.x, node.minHeight, node.z };
+    const float boxMax[3] = { node.x + node.size, node.maxHeight, node.z + node.size };
+
+    if (!sphere_intersects_box(camera, cdlod->lodRanges[lod], boxMin, boxMax))
+        return FALSE;
+
+    // Culled nodes count as handled, so the parent doesn't draw them either
+    if (frustumPlanes && box_outside_frustum(frustumPlanes, boxMin, boxMax))
+        return TRUE;
+
+    if (lod == 0 || !sphere_intersects_box(camera, cdlod->lodRanges[lod - 1], boxMin, boxMax))
+    {
+        add_selected_node(cdlod, &node);
+        return TRUE;
+    }
+
+    // Children beyond the finer range are drawn with this node's LOD. They're still drawn with the full
+    // grid at the child's size, but being out of range they're fully morphed, which is this LOD's surface.
+    for (int c = 0; c < 4; ++c)
+    {
+        const int cx = x * 2 + (c & 1);
+        const int cz = z * 2 + (c >> 1);
+        if (!select_node(cdlod, camera, frustumPlanes, lod - 1, cx, cz))
+        {
+            CdlodNode child;
+            child.size = node.size * 0.5f;
+            child.x = cx * child.size;
+            child.z = cz * child.size;
+            child.lod = lod - 1;
+            get_node_bounds(cdlod, lod - 1, cx, cz, &child.minHeight, &child.maxHeight);
+            add_selected_node(cdlod, &child);
+        }
+    }
+
+    return TRUE;
+}
+
+void cdlod_select(Cdlod* cdlod, float cameraX, float cameraY, float cameraZ, const float* frustumPlanes)
+{
+    const float camera[3] = { cameraX, cameraY, cameraZ };
+    const int topLod = CDLOD_NUM_LODS - 1;
+    const float rootSize = CDLOD_LEAF_SIZE * (float)(1 << topLod);
+    const float viewDistance = cdlod->lodRanges[topLod];
+
+    cdlod->numSelected = 0;
+
+    // The world is unbounded, so roots are tiled over the square the view distance reaches
+    const int minX = (int)floorf((cameraX - viewDistance) / rootSize);
+    const int maxX = (int)floorf((cameraX + viewDistance) / rootSize);
+    const int minZ = (int)floorf((cameraZ - viewDistance) / rootSize);
+    const int maxZ = (int)floorf((cameraZ + viewDistance) / rootSize);
+    for (int z = minZ; z <= maxZ; ++z)
+        for (int x = minX; x <= maxX; ++x)
+            select_node(cdlod, camera, frustumPlanes, topLod, x, z);
+}
+
+void cdlod_draw(const Cdlod* cdlod, const GutShaderProgram* program)
+{
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, cdlod->glPermutationTexture);
+
+    const GLint nodeLocation = gut_get_uniform_location(program, "u_Node");
+    const GLint morphLocation = gut_get_uniform_location(program, "u_Morph");
+    for (int i = 0; i < cdlod->numSelected; ++i)
+    {
+        const CdlodNode* node = &cdlod->selection[i];
+        const float nodeParams[4] = { node->x, node->z, node->size, (float)node->lod };
+        const float morphParams[2] = { cdlod->morphStarts[node->lod], cdlod->lodRanges[node->lod] };
+        gut_set_uniform(nodeLocation, GL_FLOAT_VEC4, nodeParams);
+        gut_set_uniform(morphLocation, GL_FLOAT_VEC2, morphParams);
+        mesh_draw_indexed(&cdlod->gridMesh);
+    }
+}
\ No newline at end of file
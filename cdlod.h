@@ -0,0 +1,63 @@
+#ifndef CDLOD_H
+#define CDLOD_H
+
+#include "gl.h"
+#include "glutils.h"
+#include "mesh.h"
+
+// Continuous distance-dependent LOD (Strugar, 2010). The world is covered by a quadtree whose nodes are
+// all drawn with one shared grid mesh, displaced by the terrain height in the vertex shader. Nodes are
+// selected on the CPU by distance, and vertices morph towards the next LOD's grid over the far end of
+// each LOD's range so the switch between levels is seamless.
+
+#define CDLOD_GRID_SIZE 32 // quads along each side of the shared grid mesh
+#define CDLOD_LEAF_SIZE 32.0f // world size of the finest nodes, giving one quad per unit
+#define CDLOD_NUM_LODS 6
+#define CDLOD_MORPH_START_RATIO 0.66f // fraction of each LOD's range after which vertices start morphing
+#define CDLOD_BOUNDS_CACHE_SIZE 4096 // must be a power of two
+
+typedef struct CdlodNode {
+    float x; // min corner
+    float z;
+    float size;
+    int lod;
+    float minHeight;
+    float maxHeight;
+} CdlodNode;
+
+typedef struct CdlodBoundsCacheEntry {
+    int lod;
+    int x; // node coordinate in units of the node's size
+    int z;
+    int bIsValid;
+    float minHeight;
+    float maxHeight;
+} CdlodBoundsCacheEntry;
+
+typedef struct Cdlod {
+    Mesh gridMesh;
+    GLuint glPermutationTexture;
+    float lodRanges[CDLOD_NUM_LODS];
+    float morphStarts[CDLOD_NUM_LODS];
+    CdlodNode* selection;
+    int numSelected;
+    int selectionCapacity;
+    // Node height bounds cost a grid of noise samples each, so they are kept until another node hashes
+    // to the same slot
+    CdlodBoundsCacheEntry* boundsCache;
+} Cdlod;
+
+// lod0Range is the view distance covered by the finest LOD, each coarser LOD doubles it
+void cdlod_init(Cdlod* out, float lod0Range);
+
+void cdlod_destroy(Cdlod* cdlod);
+
+// Selects the nodes to draw this frame. frustumPlanes holds six (a, b, c, d) planes with inside where
+// ax + by + cz + d >= 0, or is NULL to skip frustum culling.
+void cdlod_select(Cdlod* cdlod, float cameraX, float cameraY, float cameraZ, const float* frustumPlanes);
+
+// Draws the selected nodes with program, which must already be in use. The permutation table the
+// shader's noise needs is bound to texture unit 0.
+void cdlod_draw(const Cdlod* cdlod, const GutShaderProgram* program);
+
+#endif
\ No newline at end of file
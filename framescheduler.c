@@ -0,0 +1,53 @@
+#include "framescheduler.h"
+#include "platform.h"
+
+void frame_scheduler_init(FrameScheduler* out, double frameRate, double stepRate)
+{
+    out->frameDuration = frameRate > 0.0 ? 1.0 / frameRate : 0.0;
+    out->stepDuration = 1.0 / stepRate;
+    out->lastFrameTime = platform_get_time();
+    out->nextFrameTime = out->lastFrameTime;
+    out->accumulator = 0.0;
+}
+
+int frame_scheduler_begin_frame(FrameScheduler* scheduler)
+{
+    const double now = platform_get_time();
+    scheduler->accumulator += now - scheduler->lastFrameTime;
+    scheduler->lastFrameTime = now;
+
+    int numSteps = (int)(scheduler->accumulator / scheduler->stepDuration);
+    if (numSteps > FRAME_SCHEDULER_MAX_STEPS)
+    {
+        numSteps = FRAME_SCHEDULER_MAX_STEPS;
+        scheduler->accumulator = numSteps * scheduler->stepDuration;
+    }
+    scheduler->accumulator -= numSteps * scheduler->stepDuration;
+    return numSteps;
+}
+
+float frame_scheduler_get_step_alpha(const FrameScheduler* scheduler)
+{
+    return (float)(scheduler->accumulator / scheduler->stepDuration);
+}
+
+void frame_scheduler_wait(FrameScheduler* scheduler)
+{
+    if (scheduler->frameDuration == 0.0)
+        return;
+
+    // Frames are due on a fixed cadence, but one that ran long starts the cadence again from now
+    // rather than following it with a burst of unpaced frames
+    scheduler->nextFrameTime += scheduler->frameDuration;
+    double now = platform_get_time();
+    if (scheduler->nextFrameTime < now)
+    {
+        scheduler->nextFrameTime = now;
+        return;
+    }
+
+    if (scheduler->nextFrameTime - now > FRAME_SCHEDULER_SPIN_TIME)
+        platform_sleep(scheduler->nextFrameTime - now - FRAME_SCHEDULER_SPIN_TIME);
+
+    while (platform_get_time() < scheduler->nextFrameTime);
+}
@@ -0,0 +1,32 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+// Paces the main loop on the platform's monotonic clock. Simulation advances in fixed steps however
+// often frames are drawn, and the time left before the next frame is spent asleep, with only the last
+// FRAME_SCHEDULER_SPIN_TIME spun on the clock so the frame is not late by the sleep's imprecision.
+
+#define FRAME_SCHEDULER_SPIN_TIME 0.001 // seconds
+#define FRAME_SCHEDULER_MAX_STEPS 8 // per frame, time beyond this is dropped rather than caught up later
+
+typedef struct FrameScheduler {
+    double frameDuration; // 0 when the frame rate is not limited
+    double stepDuration;
+    double lastFrameTime;
+    double nextFrameTime;
+    double accumulator; // time not yet simulated
+} FrameScheduler;
+
+// frameRate may be 0 to draw frames as fast as the loop runs
+void frame_scheduler_init(FrameScheduler* out, double frameRate, double stepRate);
+
+// Call at the start of each frame. Returns the number of fixed steps to simulate this frame.
+int frame_scheduler_begin_frame(FrameScheduler* scheduler);
+
+// How far, as a fraction of a step, the frame is past the last step simulated. Draw the state that far
+// between the previous step and the last.
+float frame_scheduler_get_step_alpha(const FrameScheduler* scheduler);
+
+// Sleeps until the next frame is due. Call at the end of each frame.
+void frame_scheduler_wait(FrameScheduler* scheduler);
+
+#endif
@@ -1,77 +1,438 @@
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "gl.h"
 #include "glutils.h"
+#include "macromagic.h"
+
+GutExtensions gutExtensions;
+
+char gutShaderCacheDirectory[256];
+
+// Start of every shader cache file, followed by the binary
+typedef struct GutShaderCacheHeader {
+    char magic[4];
+    unsigned long long key;
+    GLenum binaryFormat;
+    GLsizei binaryLength;
+    unsigned long long binaryHash; // not every driver checks a binary before trusting it
+} GutShaderCacheHeader;
+
+void gut_load_extensions(GLADloadfunc load)
+{
+    gutExtensions.glMultiDrawElementsIndirect = NULL;
+    if (gut_has_gl_version(4, 3) || gut_has_extension("GL_ARB_multi_draw_indirect"))
+        gutExtensions.glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+
+    gutExtensions.glBufferStorage = NULL;
+    if (gut_has_gl_version(4, 4) || gut_has_extension("GL_ARB_buffer_storage"))
+        gutExtensions.glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+
+    gutExtensions.glGetProgramBinary = NULL;
+    gutExtensions.glProgramBinary = NULL;
+    gutExtensions.glProgramParameteri = NULL;
+    GLint numBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+    if ((gut_has_gl_version(4, 1) || gut_has_extension("GL_ARB_get_program_binary")) && numBinaryFormats > 0)
+    {
+        gutExtensions.glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+        gutExtensions.glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+        gutExtensions.glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+        if (!gutExtensions.glGetProgramBinary || !gutExtensions.glProgramBinary || !gutExtensions.glProgramParameteri)
+            gutExtensions.glGetProgramBinary = NULL;
+    }
+
+    // Let the driver compile on as many threads as it likes, glCompileShader and glLinkProgram then
+    // return before the work is done
+    gutExtensions.glMaxShaderCompilerThreads = NULL;
+    if (gut_has_extension("GL_KHR_parallel_shader_compile"))
+        gutExtensions.glMaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROC)load("glMaxShaderCompilerThreadsKHR");
+    else if (gut_has_extension("GL_ARB_parallel_shader_compile"))
+        gutExtensions.glMaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSPROC)load("glMaxShaderCompilerThreadsARB");
+    if (gutExtensions.glMaxShaderCompilerThreads)
+        gutExtensions.glMaxShaderCompilerThreads(0xFFFFFFFF);
+
+    LOG("Multi-draw indirect %s.", gutExtensions.glMultiDrawElementsIndirect ? "available" : "unavailable, falling back to glMultiDrawElementsBaseVertex");
+    LOG("Buffer storage %s.", gutExtensions.glBufferStorage ? "available" : "unavailable, falling back to glBufferSubData");
+    LOG("Program binaries %s.", gutExtensions.glGetProgramBinary ? "available" : "unavailable, shaders will not be cached");
+    LOG("Parallel shader compile %s.", gutExtensions.glMaxShaderCompilerThreads ? "available" : "unavailable");
+}
+
+int gut_has_gl_version(int major, int minor)
+{
+    GLint contextMajor, contextMinor;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+int gut_has_extension(const char* name)
+{
+    GLint numExtensions;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; ++i)
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i), name) == 0)
+            return TRUE;
+    return FALSE;
+}
 
 size_t gut_get_type_size(GLenum glType)
 {
     switch (glType)
     {
         case GL_FLOAT: return sizeof(float);
+        case GL_HALF_FLOAT: return sizeof(GLhalf);
         case GL_INT: 
         case GL_UNSIGNED_INT: return sizeof(int);
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT: return sizeof(short);
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE: return sizeof(char);
         default: return 0;
     }
 }
 
-int gut_create_shader(GLenum type, const GLchar* source, GLuint* shader)
+size_t gut_get_attribute_size(GLenum glType, int count)
 {
-    *shader = glCreateShader(type);
-    glShaderSource(*shader, 1, &source, NULL);
-    glCompileShader(*shader);
+    switch (glType)
+    {
+        // Packed types hold all four components in one 32-bit word
+        case GL_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_2_10_10_10_REV: return sizeof(GLuint);
+        default: return count * gut_get_type_size(glType);
+    }
+}
 
+// Logs the compile errors, if any. Waits for the compile to finish.
+int check_shader_compile(GLuint shader)
+{
     GLint  success;
-    glGetShaderiv(*shader, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if(!success)
     {
         GLchar infoLog[512];
-        glGetShaderInfoLog(*shader, 512, NULL, infoLog);
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
         LOG("Failed to compiler shader: %s", infoLog);
     }
 
     return success;
 }
 
-int gut_create_shader_program(const GLchar* vertexSource, const GLchar* fragmentSource, GLuint* program)
+int gut_create_shader(GLenum type, const GLchar* source, GLuint* shader)
+{
+    *shader = glCreateShader(type);
+    glShaderSource(*shader, 1, &source, NULL);
+    glCompileShader(*shader);
+    return check_shader_compile(*shader);
+}
+
+unsigned int hash_uniform_name(const GLchar* name)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (; *name; ++name)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+void reflect_uniforms(GutShaderProgram* program)
 {
-    GLuint vertexShader, fragmentShader;
+    for (int i = 0; i < GUT_MAX_UNIFORMS; ++i)
+        program->uniforms[i].location = -1;
 
-    if(!gut_create_shader(GL_VERTEX_SHADER, vertexSource, &vertexShader) ||
-        !gut_create_shader(GL_FRAGMENT_SHADER, fragmentSource, &fragmentShader))
+    GLint numUniforms;
+    glGetProgramiv(program->glHandle, GL_ACTIVE_UNIFORMS, &numUniforms);
+    for (GLint u = 0; u < numUniforms; ++u)
     {
-        return 0;
+        GLchar name[GUT_MAX_UNIFORM_NAME];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program->glHandle, (GLuint)u, GUT_MAX_UNIFORM_NAME, NULL, &size, &type, name);
+
+        const GLint location = glGetUniformLocation(program->glHandle, name);
+        if (location == -1)
+            continue;
+
+        // Arrays are listed as their first element, which is also where the array starts
+        char* subscript = strchr(name, '[');
+        if (subscript)
+            *subscript = '\0';
+
+        const unsigned int hash = hash_uniform_name(name);
+        int slot = hash & (GUT_MAX_UNIFORMS - 1);
+        int probes = 0;
+        while (program->uniforms[slot].location != -1 && ++probes < GUT_MAX_UNIFORMS)
+            slot = (slot + 1) & (GUT_MAX_UNIFORMS - 1);
+        if (probes == GUT_MAX_UNIFORMS)
+        {
+            LOG("Too many uniforms, %s will not be found.", name);
+            continue;
+        }
+
+        program->uniforms[slot].hash = hash;
+        program->uniforms[slot].location = location;
+        strcpy(program->uniforms[slot].name, name);
     }
+}
 
-    *program = glCreateProgram();
-    glAttachShader(*program, vertexShader);
-    glAttachShader(*program, fragmentShader);
-    glLinkProgram(*program);
+void gut_set_shader_cache_directory(const char* directory)
+{
+    gutShaderCacheDirectory[0] = '\0';
+    if (directory)
+        snprintf(gutShaderCacheDirectory, sizeof(gutShaderCacheDirectory), "%s", directory);
+}
+
+#define GUT_FNV64_OFFSET_BASIS 14695981039346656037ull
+#define GUT_FNV64_PRIME 1099511628211ull
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+// FNV-1a, 64 bit, continuing from hash. The terminator is included so consecutive strings can't run into
+// each other.
+unsigned long long hash_string(unsigned long long hash, const char* string)
+{
+    do
+        hash = (hash ^ (unsigned char)*string) * GUT_FNV64_PRIME;
+    while (*string++);
+    return hash;
+}
+
+unsigned long long hash_bytes(const void* data, size_t size)
+{
+    unsigned long long hash = GUT_FNV64_OFFSET_BASIS;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ ((const unsigned char*)data)[i]) * GUT_FNV64_PRIME;
+    return hash;
+}
+
+// Returns FALSE if the cache is off
+int get_shader_cache_key(const GLchar* vertexSource, const GLchar* fragmentSource, unsigned long long* key)
+{
+    if (!gutExtensions.glGetProgramBinary || !gutShaderCacheDirectory[0])
+        return FALSE;
+
+    unsigned long long hash = GUT_FNV64_OFFSET_BASIS;
+    hash = hash_string(hash, vertexSource);
+    hash = hash_string(hash, fragmentSource);
+    hash = hash_string(hash, (const char*)glGetString(GL_VENDOR));
+    hash = hash_string(hash, (const char*)glGetString(GL_RENDERER));
+    hash = hash_string(hash, (const char*)glGetString(GL_VERSION));
+    *key = hash;
+    return TRUE;
+}
+
+void get_shader_cache_path(unsigned long long key, char* path, size_t pathSize)
+{
+    snprintf(path, pathSize, "%s/%016llx.bin", gutShaderCacheDirectory, key);
+}
+
+int load_cached_program(const char* path, unsigned long long key, GLuint* program)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return FALSE;
+
+    GutShaderCacheHeader header;
+    void* binary = NULL;
+    int bIsLoaded = fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, "GSC1", 4) == 0 && header.key == key && header.binaryLength > 0 &&
+        (binary = malloc((size_t)header.binaryLength)) &&
+        fread(binary, (size_t)header.binaryLength, 1, file) == 1 &&
+        hash_bytes(binary, (size_t)header.binaryLength) == header.binaryHash;
+    fclose(file);
+
+    // The driver may still refuse a binary it wrote, after an update that kept the version string
+    if (bIsLoaded)
+    {
+        *program = glCreateProgram();
+        gutExtensions.glProgramBinary(*program, header.binaryFormat, binary, header.binaryLength);
+
+        GLint success;
+        glGetProgramiv(*program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(*program);
+            bIsLoaded = FALSE;
+        }
+    }
+
+    free(binary);
+    return bIsLoaded;
+}
+
+void save_cached_program(const char* path, unsigned long long key, GLuint program)
+{
+    // Zeroed first so the padding after magic is written as zeros and entries are reproducible
+    GutShaderCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "GSC1", 4);
+    header.key = key;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.binaryLength);
+    if (header.binaryLength <= 0)
+        return;
+
+    void* binary = malloc((size_t)header.binaryLength);
+    gutExtensions.glGetProgramBinary(program, header.binaryLength, NULL, &header.binaryFormat, binary);
+    header.binaryHash = hash_bytes(binary, (size_t)header.binaryLength);
+
+    FILE* file = fopen(path, "wb");
+    if (file)
+    {
+        if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(binary, (size_t)header.binaryLength, 1, file) != 1)
+            LOG("Failed to write shader cache file %s.", path);
+        fclose(file);
+    }
+    else
+        LOG("Failed to create shader cache file %s.", path);
+
+    free(binary);
+}
+
+GLuint begin_shader_compile(GLenum type, const GLchar* source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+void gut_begin_shader_program(const GLchar* vertexSource, const GLchar* fragmentSource, GutShaderProgram* program)
+{
+    program->glHandle = 0;
+    program->glVertexShader = 0;
+    program->glFragmentShader = 0;
+    program->bIsPending = TRUE;
+    for (int i = 0; i < GUT_MAX_UNIFORMS; ++i)
+        program->uniforms[i].location = -1;
+
+    program->bUseCache = get_shader_cache_key(vertexSource, fragmentSource, &program->cacheKey);
+    if (program->bUseCache)
+    {
+        char cachePath[512];
+        get_shader_cache_path(program->cacheKey, cachePath, sizeof(cachePath));
+        if (load_cached_program(cachePath, program->cacheKey, &program->glHandle))
+            return;
+    }
+
+    program->glVertexShader = begin_shader_compile(GL_VERTEX_SHADER, vertexSource);
+    program->glFragmentShader = begin_shader_compile(GL_FRAGMENT_SHADER, fragmentSource);
+
+    program->glHandle = glCreateProgram();
+    glAttachShader(program->glHandle, program->glVertexShader);
+    glAttachShader(program->glHandle, program->glFragmentShader);
+    if (program->bUseCache)
+        gutExtensions.glProgramParameteri(program->glHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program->glHandle);
+}
+
+int gut_finish_shader_program(GutShaderProgram* program)
+{
+    if (!program->bIsPending)
+        return program->glHandle != 0;
+    program->bIsPending = FALSE;
+
+    // Loaded from the cache, already linked
+    if (!program->glVertexShader)
+    {
+        reflect_uniforms(program);
+        return TRUE;
+    }
 
     GLint success;
-    glGetProgramiv(*program, GL_LINK_STATUS, &success);
+    glGetProgramiv(program->glHandle, GL_LINK_STATUS, &success);
     if(!success)
     {
+        check_shader_compile(program->glVertexShader);
+        check_shader_compile(program->glFragmentShader);
+
         GLchar infoLog[512];
-        glGetProgramInfoLog(*program, 512, NULL, infoLog);
+        glGetProgramInfoLog(program->glHandle, 512, NULL, infoLog);
         LOG("Shader error: %s", infoLog);
     }
 
-    return success;
+    glDeleteShader(program->glVertexShader);
+    glDeleteShader(program->glFragmentShader);
+    program->glVertexShader = 0;
+    program->glFragmentShader = 0;
+
+    if (!success)
+    {
+        glDeleteProgram(program->glHandle);
+        program->glHandle = 0;
+        return FALSE;
+    }
+
+    if (program->bUseCache)
+    {
+        char cachePath[512];
+        get_shader_cache_path(program->cacheKey, cachePath, sizeof(cachePath));
+        save_cached_program(cachePath, program->cacheKey, program->glHandle);
+    }
+
+    reflect_uniforms(program);
+    return TRUE;
+}
+
+int gut_create_shader_program(const GLchar* vertexSource, const GLchar* fragmentSource, GutShaderProgram* program)
+{
+    gut_begin_shader_program(vertexSource, fragmentSource, program);
+    return gut_finish_shader_program(program);
+}
+
+void gut_destroy_shader_program(GutShaderProgram* program)
+{
+    // A program begun but never finished still holds its shaders, which finishing would have deleted
+    glDeleteShader(program->glVertexShader);
+    glDeleteShader(program->glFragmentShader);
+    program->glVertexShader = 0;
+    program->glFragmentShader = 0;
+    program->bIsPending = FALSE;
+
+    glDeleteProgram(program->glHandle);
+    program->glHandle = 0;
 }
 
-void gut_set_shader_uniform(GLuint glProgram, GLint uniformType, const GLchar* uniformName, const void* data)
+GLint gut_get_uniform_location(const GutShaderProgram* program, const GLchar* uniformName)
 {
-    GLint location = glGetUniformLocation(glProgram, uniformName);
+    const unsigned int hash = hash_uniform_name(uniformName);
+    int slot = hash & (GUT_MAX_UNIFORMS - 1);
+    for (int probes = 0; probes < GUT_MAX_UNIFORMS && program->uniforms[slot].location != -1; ++probes)
+    {
+        const GutUniform* uniform = &program->uniforms[slot];
+        if (uniform->hash == hash && strcmp(uniform->name, uniformName) == 0)
+            return uniform->location;
+        slot = (slot + 1) & (GUT_MAX_UNIFORMS - 1);
+    }
+    return -1;
+}
+
+void gut_bind_uniform_block(const GutShaderProgram* program, const GLchar* blockName, GLuint binding)
+{
+    const GLuint index = glGetUniformBlockIndex(program->glHandle, blockName);
+    if (index == GL_INVALID_INDEX)
+    {
+        LOG("No uniform block %s found.", blockName);
+        return;
+    }
+    glUniformBlockBinding(program->glHandle, index, binding);
+}
+
+void gut_set_shader_uniform(const GutShaderProgram* program, GLint uniformType, const GLchar* uniformName, const void* data)
+{
+    GLint location = gut_get_uniform_location(program, uniformName);
     if (location == -1)
     {
         LOG("No unfiform found");
         return;
     }
 
+    gut_set_uniform(location, uniformType, data);
+}
+
+void gut_set_uniform(GLint location, GLint uniformType, const void* data)
+{
     switch(uniformType)
     {
+    case GL_INT: glUniform1iv(location, 1, (GLint*)data); break;
     case GL_FLOAT_VEC2: glUniform2fv(location, 1, (GLfloat*)data); break;
     case GL_FLOAT_VEC3: glUniform3fv(location, 1, (GLfloat*)data); break;
     case GL_FLOAT_VEC4: glUniform4fv(location, 1, (GLfloat*)data); break;
@@ -80,11 +441,11 @@ void gut_set_shader_uniform(GLuint glProgram, GLint uniformType, const GLchar* u
     }
 }
 
-void gut_create_buffer(GLuint* glHandle, size_t size, void* data, GLenum usage)
+void gut_create_buffer(GLuint* glHandle, GLenum target, size_t size, void* data, GLenum usage)
 {
     glGenBuffers(1, glHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, *glHandle);
-    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)size, data, usage);
+    glBindBuffer(target, *glHandle);
+    glBufferData(target, (GLsizeiptr)size, data, usage);
 }
 
 GLuint gut_create_texture()
@@ -110,4 +471,80 @@ GLuint gut_create_texture()
     // }
     // stbi_image_free(data);
     return texture;
+}
+
+void gut_gpu_timer_init(GutGpuTimer* out)
+{
+    glGenQueries(GUT_GPU_TIMER_LATENCY * GUT_GPU_TIMER_MAX_REGIONS, out->glQueries[0]);
+    for (int f = 0; f < GUT_GPU_TIMER_LATENCY; ++f)
+        for (int r = 0; r < GUT_GPU_TIMER_MAX_REGIONS; ++r)
+            out->bIsQueryIssued[f][r] = FALSE;
+    out->numRegions = 0;
+    out->frame = 0;
+    out->activeRegion = -1;
+}
+
+void gut_gpu_timer_destroy(GutGpuTimer* timer)
+{
+    glDeleteQueries(GUT_GPU_TIMER_LATENCY * GUT_GPU_TIMER_MAX_REGIONS, timer->glQueries[0]);
+    timer->numRegions = 0;
+}
+
+void gut_gpu_timer_begin(GutGpuTimer* timer, const char* name)
+{
+    int region = 0;
+    while (region < timer->numRegions && strcmp(timer->regionNames[region], name) != 0)
+        region++;
+
+    if (region == timer->numRegions)
+    {
+        if (region == GUT_GPU_TIMER_MAX_REGIONS)
+            return;
+        timer->regionNames[region] = name;
+        timer->regionTimes[region] = 0.0;
+        timer->numResults[region] = 0;
+        timer->numRegions++;
+    }
+
+    if (timer->bIsQueryIssued[timer->frame][region])
+        return;
+
+    glBeginQuery(GL_TIME_ELAPSED, timer->glQueries[timer->frame][region]);
+    timer->bIsQueryIssued[timer->frame][region] = TRUE;
+    timer->activeRegion = region;
+}
+
+void gut_gpu_timer_end(GutGpuTimer* timer)
+{
+    if (timer->activeRegion < 0)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    timer->activeRegion = -1;
+}
+
+void gut_gpu_timer_end_frame(GutGpuTimer* timer)
+{
+    // The next frame reuses the queries issued GUT_GPU_TIMER_LATENCY - 1 frames ago, so they are read
+    // now. One still not available means the GPU is further behind than that, and its result is dropped
+    // rather than waited for.
+    timer->frame = (timer->frame + 1) % GUT_GPU_TIMER_LATENCY;
+    for (int r = 0; r < timer->numRegions; ++r)
+    {
+        // Never left holding an older frame's time, which would be reported again as a new one
+        timer->regionTimes[r] = 0.0;
+        if (!timer->bIsQueryIssued[timer->frame][r])
+            continue;
+
+        GLuint bIsAvailable;
+        glGetQueryObjectuiv(timer->glQueries[timer->frame][r], GL_QUERY_RESULT_AVAILABLE, &bIsAvailable);
+        if (bIsAvailable)
+        {
+            GLuint64 nanoseconds;
+            glGetQueryObjectui64v(timer->glQueries[timer->frame][r], GL_QUERY_RESULT, &nanoseconds);
+            if (timer->numResults[r]++ > 0)
+                timer->regionTimes[r] = (double)nanoseconds * 1e-9;
+        }
+        timer->bIsQueryIssued[timer->frame][r] = FALSE;
+    }
 }
\ No newline at end of file
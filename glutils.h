@@ -4,16 +4,136 @@
 #include "logging.h"
 #include "gl.h"
 
+// Entry points newer than the GL 3.3 core gl.h loads. gut_load_extensions fills in those the context
+// supports and leaves the rest NULL, so callers check before use and fall back to 3.3.
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void (GLAD_API_PTR *PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (GLAD_API_PTR *PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (GLAD_API_PTR *PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (GLAD_API_PTR *PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (GLAD_API_PTR *PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (GLAD_API_PTR *PFNGLMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+typedef struct GutExtensions {
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect; // GL 4.3 or ARB_multi_draw_indirect
+    PFNGLBUFFERSTORAGEPROC glBufferStorage; // GL 4.4 or ARB_buffer_storage
+    // GL 4.1 or ARB_get_program_binary, and only set if the driver offers at least one binary format
+    PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+    PFNGLPROGRAMBINARYPROC glProgramBinary;
+    PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+    PFNGLMAXSHADERCOMPILERTHREADSPROC glMaxShaderCompilerThreads; // KHR or ARB_parallel_shader_compile
+} GutExtensions;
+
+extern GutExtensions gutExtensions;
+
+#define GUT_MAX_UNIFORMS 32 // per program, must be a power of two
+#define GUT_MAX_UNIFORM_NAME 32
+
+typedef struct GutUniform {
+    unsigned int hash;
+    GLint location; // -1 for an empty slot
+    char name[GUT_MAX_UNIFORM_NAME];
+} GutUniform;
+
+typedef struct GutShaderProgram {
+    GLuint glHandle;
+    GutUniform uniforms[GUT_MAX_UNIFORMS]; // open addressed by name hash
+    // Until gut_finish_shader_program. The shaders are 0 if the program came from the shader cache.
+    int bIsPending;
+    GLuint glVertexShader;
+    GLuint glFragmentShader;
+    int bUseCache;
+    unsigned long long cacheKey;
+} GutShaderProgram;
+
+// Call once the context is current and gl.h is loaded, with the platform's GL proc address lookup
+void gut_load_extensions(GLADloadfunc load);
+
+int gut_has_gl_version(int major, int minor);
+
+int gut_has_extension(const char* name);
+
 size_t gut_get_type_size(GLenum type);
 
+// Size in bytes of a vertex attribute with count components of type, including packed types
+size_t gut_get_attribute_size(GLenum type, int count);
+
 int gut_create_shader(GLenum type, const GLchar* source, GLuint* shader);
 
-int gut_create_shader_program(const GLchar* vertexSource, const GLchar* fragmentSource, GLuint* program);
+// Linked programs are cached as driver binaries in directory, one file per combination of sources and
+// driver, so editing a shader or updating the driver just misses the cache. NULL disables the cache,
+// which is also off where program binaries are unsupported.
+void gut_set_shader_cache_directory(const char* directory);
+
+// Starts compiling and linking the program, or loads it from the shader cache, without asking GL how
+// either went, since that waits for the driver. With parallel shader compile the work then continues
+// on driver threads, so begin every program up front and finish each just before it is first used.
+void gut_begin_shader_program(const GLchar* vertexSource, const GLchar* fragmentSource, GutShaderProgram* program);
+
+// Waits for the link, logs any errors, writes the shader cache and records where the active uniforms
+// are, so setting them by name never asks GL. Returns FALSE, with glHandle 0, if the program failed.
+// Later calls just return the result again.
+int gut_finish_shader_program(GutShaderProgram* program);
 
-void gut_set_shader_uniform(GLuint glProgram, GLint uniformType, const GLchar* uniformName, const void* data);
+// Begins and finishes the program at once
+int gut_create_shader_program(const GLchar* vertexSource, const GLchar* fragmentSource, GutShaderProgram* program);
 
-void gut_create_buffer(GLuint* glHandle, size_t size, void* data, GLenum draw);
+void gut_destroy_shader_program(GutShaderProgram* program);
+
+// Returns -1 if the program has no such uniform. Uniforms in blocks have no location.
+GLint gut_get_uniform_location(const GutShaderProgram* program, const GLchar* uniformName);
+
+// Points the program's uniform block at a GL_UNIFORM_BUFFER binding, GLSL 3.30 can't do it in the shader
+void gut_bind_uniform_block(const GutShaderProgram* program, const GLchar* blockName, GLuint binding);
+
+void gut_set_shader_uniform(const GutShaderProgram* program, GLint uniformType, const GLchar* uniformName, const void* data);
+
+// For the program in use. Locations of -1 are ignored.
+void gut_set_uniform(GLint location, GLint uniformType, const void* data);
+
+void gut_create_buffer(GLuint* glHandle, GLenum target, size_t size, void* data, GLenum draw);
 
 GLuint gut_create_texture();
 
+// Times named regions of GPU work with GL_TIME_ELAPSED queries. Each region has a query per frame in
+// flight and a frame's results are only read GUT_GPU_TIMER_LATENCY - 1 frames later, once available, so
+// timing never waits on the GPU. A region is timed once per frame, and regions may not nest or overlap
+// since only one elapsed time query can be active at once.
+// Software rasterisers such as llvmpipe stamp queries as commands are set up rather than as they are
+// rasterised, so there the times cover vertex work and binning only.
+
+#define GUT_GPU_TIMER_LATENCY 3
+#define GUT_GPU_TIMER_MAX_REGIONS 16
+
+typedef struct GutGpuTimer {
+    const char* regionNames[GUT_GPU_TIMER_MAX_REGIONS];
+    double regionTimes[GUT_GPU_TIMER_MAX_REGIONS]; // seconds, 0 when the last frame read had no result
+    int numResults[GUT_GPU_TIMER_MAX_REGIONS]; // read so far, the first of which is discarded
+    GLuint glQueries[GUT_GPU_TIMER_LATENCY][GUT_GPU_TIMER_MAX_REGIONS];
+    int bIsQueryIssued[GUT_GPU_TIMER_LATENCY][GUT_GPU_TIMER_MAX_REGIONS];
+    int numRegions;
+    int frame; // which set of queries the current frame uses
+    int activeRegion; // -1 outside any region
+} GutGpuTimer;
+
+void gut_gpu_timer_init(GutGpuTimer* out);
+
+void gut_gpu_timer_destroy(GutGpuTimer* timer);
+
+// name is kept by pointer. Regions past GUT_GPU_TIMER_MAX_REGIONS, or begun twice in a frame, go untimed.
+void gut_gpu_timer_begin(GutGpuTimer* timer, const char* name);
+
+void gut_gpu_timer_end(GutGpuTimer* timer);
+
+// Reads the results of the oldest frame in flight. Call once per frame, after its last region. A region
+// reads as 0 if it had no query that frame, its result was not ready, or it was the region's first
+// result, which llvmpipe has been seen to get wrong by thousands of seconds.
+void gut_gpu_timer_end_frame(GutGpuTimer* timer);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "jobs.h"
+#include "macromagic.h"
+
+int jobs_get_num_cores()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+void* jobs_worker(void* arg)
+{
+    JobSystem* jobSystem = (JobSystem*)arg;
+
+    while (TRUE)
+    {
+        pthread_mutex_lock(&jobSystem->mutex);
+        while (jobSystem->numJobs == 0 && jobSystem->bIsRunning)
+            pthread_cond_wait(&jobSystem->cond, &jobSystem->mutex);
+
+        if (jobSystem->numJobs == 0)
+        {
+            pthread_mutex_unlock(&jobSystem->mutex);
+            break;
+        }
+
+        Job job = jobSystem->jobs[jobSystem->jobsHead];
+        jobSystem->jobsHead = (jobSystem->jobsHead + 1) % jobSystem->jobsCapacity;
+        jobSystem->numJobs--;
+        pthread_mutex_unlock(&jobSystem->mutex);
+
+        job.func(job.userData);
+    }
+
+    return NULL;
+}
+
+void jobs_init(JobSystem* out, int numThreads)
+{
+    pthread_mutex_init(&out->mutex, NULL);
+    pthread_cond_init(&out->cond, NULL);
+    out->jobsCapacity = 64;
+    out->jobs = (Job*)malloc(sizeof(Job) * out->jobsCapacity);
+    out->jobsHead = 0;
+    out->numJobs = 0;
+    out->bIsRunning = TRUE;
+
+    out->numThreads = numThreads < 1 ? 1 : numThreads;
+    out->threads = (pthread_t*)malloc(sizeof(pthread_t) * out->numThreads);
+    for (int i = 0; i < out->numThreads; ++i)
+        pthread_create(&out->threads[i], NULL, jobs_worker, out);
+}
+
+void jobs_destroy(JobSystem* jobSystem)
+{
+    // Workers drain whatever is still queued before they exit
+    pthread_mutex_lock(&jobSystem->mutex);
+    jobSystem->bIsRunning = FALSE;
+    pthread_cond_broadcast(&jobSystem->cond);
+    pthread_mutex_unlock(&jobSystem->mutex);
+
+    for (int i = 0; i < jobSystem->numThreads; ++i)
+        pthread_join(jobSystem->threads[i], NULL);
+
+    free(jobSystem->threads);
+    free(jobSystem->jobs);
+    pthread_cond_destroy(&jobSystem->cond);
+    pthread_mutex_destroy(&jobSystem->mutex);
+}
+
+void jobs_submit(JobSystem* jobSystem, JobFunc* func, void* userData)
+{
+    pthread_mutex_lock(&jobSystem->mutex);
+
+    if (jobSystem->numJobs == jobSystem->jobsCapacity)
+    {
+        // Grow and unwrap the ring so the pending jobs start at 0 again
+        Job* jobs = (Job*)malloc(sizeof(Job) * jobSystem->jobsCapacity * 2);
+        for (int i = 0; i < jobSystem->numJobs; ++i)
+            jobs[i] = jobSystem->jobs[(jobSystem->jobsHead + i) % jobSystem->jobsCapacity];
+        free(jobSystem->jobs);
+        jobSystem->jobs = jobs;
+        jobSystem->jobsHead = 0;
+        jobSystem->jobsCapacity *= 2;
+    }
+
+    Job* job = &jobSystem->jobs[(jobSystem->jobsHead + jobSystem->numJobs) % jobSystem->jobsCapacity];
+    job->func = func;
+    job->userData = userData;
+    jobSystem->numJobs++;
+
+    pthread_cond_signal(&jobSystem->cond);
+    pthread_mutex_unlock(&jobSystem->mutex);
+}
+
+void jobs_completion_queue_init(JobCompletionQueue* out, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+
+    out->cells = (JobCompletionCell*)malloc(sizeof(JobCompletionCell) * size);
+    out->mask = size - 1;
+    for (size_t i = 0; i < size; ++i)
+        atomic_init(&out->cells[i].sequence, i);
+    atomic_init(&out->enqueuePos, 0);
+    atomic_init(&out->dequeuePos, 0);
+}
+
+void jobs_completion_queue_destroy(JobCompletionQueue* queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+int jobs_completion_queue_push(JobCompletionQueue* queue, void* data)
+{
+    JobCompletionCell* cell;
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    while (TRUE)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return FALSE;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    cell->data = data;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return TRUE;
+}
+
+void* jobs_completion_queue_pop(JobCompletionQueue* queue)
+{
+    JobCompletionCell* cell;
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    while (TRUE)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    void* data = cell->data;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return data;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef void JobFunc(void* userData);
+
+typedef struct Job {
+    JobFunc* func;
+    void* userData;
+} Job;
+
+// Worker thread pool. Jobs are pulled from a mutex-protected FIFO, which is only touched once per job.
+typedef struct JobSystem {
+    pthread_t* threads;
+    int numThreads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Job* jobs; // ring buffer of pending jobs
+    int jobsHead;
+    int numJobs;
+    int jobsCapacity;
+    int bIsRunning;
+} JobSystem;
+
+typedef struct JobCompletionCell {
+    atomic_size_t sequence;
+    void* data;
+} JobCompletionCell;
+
+// Bounded lock-free queue (Vyukov's MPMC ring) used by workers to hand finished work back to the main
+// thread without ever taking a lock on the main thread.
+typedef struct JobCompletionQueue {
+    JobCompletionCell* cells;
+    size_t mask;
+    atomic_size_t enqueuePos;
+    atomic_size_t dequeuePos;
+} JobCompletionQueue;
+
+int jobs_get_num_cores();
+
+void jobs_init(JobSystem* out, int numThreads);
+
+void jobs_destroy(JobSystem* jobSystem);
+
+void jobs_submit(JobSystem* jobSystem, JobFunc* func, void* userData);
+
+// capacity is rounded up to a power of two
+void jobs_completion_queue_init(JobCompletionQueue* out, size_t capacity);
+
+void jobs_completion_queue_destroy(JobCompletionQueue* queue);
+
+// Returns FALSE if the queue is full
+int jobs_completion_queue_push(JobCompletionQueue* queue, void* data);
+
+// Returns NULL if the queue is empty
+void* jobs_completion_queue_pop(JobCompletionQueue* queue);
+
+#endif
\ No newline at end of file
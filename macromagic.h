@@ -4,6 +4,10 @@
 #define CAT(a, ...) PRIMITIVE_CAT(a, __VA_ARGS__)
 #define PRIMITIVE_CAT(a, ...) a ## __VA_ARGS__
 #endif
+#ifndef STRINGIFY
+#define STRINGIFY(a) PRIMITIVE_STRINGIFY(a)
+#define PRIMITIVE_STRINGIFY(a) #a
+#endif
 #define FALSE 0
 #define TRUE 1
 #endif
\ No newline at end of file
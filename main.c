@@ -1,5 +1,5 @@
 #include <stdio.h>
-#include <time.h>
+#include <string.h>
 
 #define WINDOW_WIDTH 1200
 #define WINDOW_HEIGHT 800
@@ -14,11 +14,35 @@
 
 #define TARGET_FPS 60
 
+// Camera movement is simulated at this rate, however often frames are drawn
+#define SIMULATION_STEP_RATE 120
+
+// Largest on-screen error, in pixels, a chunk LOD may introduce
+#define TERRAIN_LOD_PIXEL_ERROR 2.0f
+
+// View distance covered by the finest CDLOD level, each coarser one doubles it
+#define CDLOD_LOD0_RANGE 64.0f
+
+// Chunks within this many of the camera's are rasterised as occluders for the ones behind them
+#define TERRAIN_OCCLUDER_DISTANCE 2
+
+// Seconds per frame the main thread may spend uploading generated chunks to the GPU
+#define TERRAIN_UPLOAD_BUDGET 0.002
+
+// Linked shader programs are cached here between runs, relative to the working directory
+#define SHADER_CACHE_DIRECTORY "shadercache"
+
+#include "benchmark.h"
+#include "camerapath.h"
+#include "cdlod.h"
+#include "framescheduler.h"
 #include "gl.h"
 #include "glutils.h"
 #include "logging.h"
 #include "mathutils.h"
+#include "occlusion.h"
 #include "platform.h"
+#include "profiler.h"
 #include "terrain.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "texture.h"
@@ -30,34 +54,65 @@
 // stitch lod seams
 // texture blending
 
-typedef struct ShaderProgram {
-	GLuint glHandle;
-} ShaderProgram_t;
+// Per-frame uniforms, shared by every program through one std140 uniform buffer at this binding
+#define FRAME_UNIFORMS_BINDING 0
+
+#define FRAME_UNIFORMS_GLSL \
+	"layout (std140) uniform FrameUniforms" \
+	"{" \
+		"mat4 u_ProjectionMatrix;" \
+		"mat4 u_ViewMatrix;" \
+		"vec3 u_LightDirection;" \
+		"vec3 u_CameraPosition;" \
+	"};"
+
+// std140 layout of FrameUniforms, where a vec3 takes the space of a vec4
+typedef struct FrameUniforms {
+	float projectionMatrix[16];
+	float viewMatrix[16];
+	float lightDirection[3];
+	float padding0;
+	float cameraPosition[3];
+	float padding1;
+} FrameUniforms;
 
 typedef struct ApplicationState {
 	GLuint bIsRunning;
-	ShaderProgram_t shaderProgram;
+	GutShaderProgram shaderProgram;
+	GutShaderProgram cdlodShaderProgram;
+	GLuint glFrameUniformBuffer;
 } ApplicationState_t;
 
 int setup_state(struct ApplicationState* state)
 {
+	// Terrain uses TERRAIN_VERTEX_FORMAT_COMPACT, see terrain.h for the layout
 	const char * vertexShaderSource = "#version 330 core\n"
-		"layout (location = 0) in vec3 a_Position;"
-		"layout (location = 1) in vec3 a_Normal;"
-		"layout (location = 2) in vec2 a_TexCoords;"
-		"uniform mat4 u_ProjectionMatrix;"
-		"uniform mat4 u_ViewMatrix;"
+		"layout (location = 0) in float a_Height;"
+		"layout (location = 1) in vec2 a_Normal;"
+		FRAME_UNIFORMS_GLSL
+		"uniform isamplerBuffer u_ChunkCoords;"
+		"const int CHUNK_SIZE = " STRINGIFY(TERRAIN_CHUNK_SIZE) ";"
+		"const int CHUNK_VERTICES = (CHUNK_SIZE + 1) * (CHUNK_SIZE + 1);"
+		"const vec2 HEIGHT_RANGE = vec2(" STRINGIFY(TERRAIN_HEIGHT_MIN) ", " STRINGIFY(TERRAIN_HEIGHT_MAX) ");"
 		"out vec3 vertexNormal;"
 		"out vec2 vertexTexCoords;"
 		"void main()"
 		"{"
-			"vertexNormal = a_Normal;"
-			"vertexTexCoords = a_TexCoords;"
-			"gl_Position = u_ProjectionMatrix * u_ViewMatrix * vec4(a_Position, 1.0);"
+			"int slot = gl_VertexID / CHUNK_VERTICES;"
+			"int vertex = gl_VertexID - slot * CHUNK_VERTICES;"
+			"ivec2 origin = texelFetch(u_ChunkCoords, slot).xy * CHUNK_SIZE;"
+			"ivec2 cell = ivec2(vertex % (CHUNK_SIZE + 1), vertex / (CHUNK_SIZE + 1));"
+			"vec3 position = vec3(origin.x + cell.x, mix(HEIGHT_RANGE.x, HEIGHT_RANGE.y, a_Height), origin.y + cell.y);"
+			"vec3 normal = vec3(a_Normal.x, 1.0 - abs(a_Normal.x) - abs(a_Normal.y), a_Normal.y);"
+			"if (normal.y < 0.0)"
+				"normal.xz = (1.0 - abs(normal.zx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.z >= 0.0 ? 1.0 : -1.0);"
+			"vertexNormal = normalize(normal);"
+			"vertexTexCoords = vec2(cell) / CHUNK_SIZE;"
+			"gl_Position = u_ProjectionMatrix * u_ViewMatrix * vec4(position, 1.0);"
 		"}";
 
 	const char * fragmentShaderSource = "#version 330 core\n"
-		"uniform vec3 u_LightDirection;"
+		FRAME_UNIFORMS_GLSL
 		"in vec3 vertexNormal;"
 		"in vec2 vertexTexCoords;"
 		"flat in uint vertexTerrain;"
@@ -70,7 +125,109 @@ int setup_state(struct ApplicationState* state)
 			"o_color = vec4(vec3(1, 0, 0) * (ambient + diffuse), 1.0f);"
 		"}";
 
-	return gut_create_shader_program(vertexShaderSource, fragmentShaderSource, &state->shaderProgram.glHandle);
+	// CDLOD nodes are one shared grid, displaced here by the same fractal terrain.c generates chunks with
+	// (noise.h's simplex noise2d, with its permutation table in u_NoisePermutation). Vertices morph onto
+	// the next LOD's grid as they approach the end of their LOD's range.
+	const char * cdlodVertexShaderSource = "#version 330 core\n"
+		"layout (location = 0) in vec2 a_GridPosition;"
+		FRAME_UNIFORMS_GLSL
+		"uniform vec4 u_Node;" // x, z, size, lod
+		"uniform vec2 u_Morph;" // start and end distance
+		"uniform usampler2D u_NoisePermutation;"
+		"const float GRID_SIZE = " STRINGIFY(CDLOD_GRID_SIZE) ";"
+		"out vec3 vertexNormal;"
+		"out vec2 vertexTexCoords;"
+		"int perm(int i)"
+		"{"
+			"return int(texelFetch(u_NoisePermutation, ivec2(i, 0), 0).r);"
+		"}"
+		"float grad2d(int hash, vec2 p)"
+		"{"
+			"int h = hash & 0x3F;"
+			"float u = h < 4 ? p.x : p.y;"
+			"float v = h < 4 ? p.y : p.x;"
+			"return ((h & 1) != 0 ? -u : u) + ((h & 2) != 0 ? -2.0 * v : 2.0 * v);"
+		"}"
+		"float noise2d(vec2 p)"
+		"{"
+			"const float F2 = 0.366025403;"
+			"const float G2 = 0.211324865;"
+			"ivec2 cell = ivec2(floor(p + (p.x + p.y) * F2));"
+			"vec2 p0 = p - (vec2(cell) - float(cell.x + cell.y) * G2);"
+			"ivec2 o = p0.x > p0.y ? ivec2(1, 0) : ivec2(0, 1);"
+			"vec2 p1 = p0 - vec2(o) + G2;"
+			"vec2 p2 = p0 - 1.0 + 2.0 * G2;"
+			"int ii = cell.x & 255;"
+			"int jj = cell.y & 255;"
+			"vec3 t = max(vec3(0.5) - vec3(dot(p0, p0), dot(p1, p1), dot(p2, p2)), 0.0);"
+			"t *= t;"
+			"t *= t;"
+			"return 45.23065 * (t.x * grad2d(perm(ii + perm(jj)), p0)"
+				"+ t.y * grad2d(perm(ii + o.x + perm(jj + o.y)), p1)"
+				"+ t.z * grad2d(perm(ii + 1 + perm(jj + 1)), p2));"
+		"}"
+		"float terrainHeight(vec2 p)"
+		"{"
+			"float height = 0.0;"
+			"float denom = 0.0;"
+			"float freq = " STRINGIFY(TERRAIN_NOISE_FREQUENCY) ";"
+			"float amp = 1.0;"
+			"for (int i = 0; i < " STRINGIFY(TERRAIN_NOISE_OCTAVES) "; ++i)"
+			"{"
+				"height += amp * noise2d(p * freq);"
+				"denom += amp;"
+				"freq *= " STRINGIFY(TERRAIN_NOISE_LACUNARITY) ";"
+				"amp *= " STRINGIFY(TERRAIN_NOISE_PERSISTENCE) ";"
+			"}"
+			"return height / denom * " STRINGIFY(TERRAIN_HEIGHT_SCALE) ";"
+		"}"
+		"void main()"
+		"{"
+			"vec2 position = u_Node.xy + a_GridPosition * u_Node.z;"
+			"float distance = length(vec3(position.x, terrainHeight(position), position.y) - u_CameraPosition);"
+			"float morph = clamp((distance - u_Morph.x) / (u_Morph.y - u_Morph.x), 0.0, 1.0);"
+			"vec2 gridPosition = a_GridPosition - fract(a_GridPosition * GRID_SIZE * 0.5) * 2.0 / GRID_SIZE * morph;"
+			"position = u_Node.xy + gridPosition * u_Node.z;"
+			"float height = terrainHeight(position);"
+			"float spacing = u_Node.z / GRID_SIZE;"
+			"vertexNormal = normalize(vec3(height - terrainHeight(position + vec2(spacing, 0.0)), spacing, height - terrainHeight(position + vec2(0.0, spacing))));"
+			"vertexTexCoords = position / " STRINGIFY(TERRAIN_CHUNK_SIZE) ";"
+			"gl_Position = u_ProjectionMatrix * u_ViewMatrix * vec4(position.x, height, position.y, 1.0);"
+		"}";
+
+	// Finished by use_shader_program, so the driver compiles while the rest of startup runs
+	gut_begin_shader_program(vertexShaderSource, fragmentShaderSource, &state->shaderProgram);
+	gut_begin_shader_program(cdlodVertexShaderSource, fragmentShaderSource, &state->cdlodShaderProgram);
+
+	gut_create_buffer(&state->glFrameUniformBuffer, GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, state->glFrameUniformBuffer);
+	return TRUE;
+}
+
+// Makes the program current, waiting for its link the first time it is used
+int use_shader_program(GutShaderProgram* program)
+{
+	if (program->bIsPending)
+	{
+		if (!gut_finish_shader_program(program))
+			return FALSE;
+		gut_bind_uniform_block(program, "FrameUniforms", FRAME_UNIFORMS_BINDING);
+	}
+
+	if (!program->glHandle)
+		return FALSE;
+
+	glUseProgram(program->glHandle);
+	return TRUE;
+}
+
+// Returns the argument following name on the command line, or NULL if it is not there
+const char* get_option(int argc, char** argv, const char* name)
+{
+	for (int i = 1; i + 1 < argc; ++i)
+		if (strcmp(argv[i], name) == 0)
+			return argv[i + 1];
+	return NULL;
 }
 
 int main(int argc, char** argv)
@@ -79,14 +236,17 @@ int main(int argc, char** argv)
 	Vec3 cameraForward = { 1, 0, -1 };
 	Vec3 cameraUp = { 0, 1, 0 };
 
-	HINSTANCE hInstance = GetModuleHandle(NULL);
+	PlatformWindow* window = platform_create_window(WINDOW_WIDTH, WINDOW_HEIGHT, "Hello World", 3, 3);
 
-	HWND hWnd = create_window(hInstance, WINDOW_WIDTH, WINDOW_HEIGHT, "Hello World");
-	HDC hDeviceContext = GetDC(hWnd);
-	HGLRC hRenderingContext = init_opengl(hDeviceContext, 3, 3);
+	// --input <path> replays a script of input events, see platform_load_input_script
+	const char* inputPath = get_option(argc, argv, "--input");
+	if (inputPath && !platform_load_input_script(inputPath))
+		LOG("Failed to load input script %s.", inputPath);
 
-	ShowWindow(hWnd, SW_SHOW);
-	UpdateWindow(hWnd);
+	if (platform_create_directory(SHADER_CACHE_DIRECTORY))
+		gut_set_shader_cache_directory(SHADER_CACHE_DIRECTORY);
+	else
+		LOG("Failed to create the shader cache directory, shaders will not be cached.");
 
 	ApplicationState_t state;
 	if (!setup_state(&state))
@@ -94,125 +254,324 @@ int main(int argc, char** argv)
 		LOGFATAL("Failed to setup application state.");
 	}
 
-	TerrainChunk chunk;
-	terrain_create_chunk_mesh(&chunk);
-
-	clock_t lastTickStart = clock();
-	float elapsedSinceLastFrame = 1.0f / TARGET_FPS;
+	terrain_set_vertex_format(TERRAIN_VERTEX_FORMAT_COMPACT);
+	terrain_create_gpu_buffers((2 * TERRAIN_CHUNK_DISTANCE + 1) * (2 * TERRAIN_CHUNK_DISTANCE + 1));
+
+	// Leave a core for the main thread
+	TerrainGenerator terrainGenerator;
+	terrain_generator_init(&terrainGenerator, jobs_get_num_cores() - 1);
+
+	TerrainChunkGrid terrainGrid;
+	terrain_chunk_grid_init(&terrainGrid, TERRAIN_CHUNK_DISTANCE);
+
+	// L switches between streamed chunks and CDLOD
+	Cdlod cdlod;
+	cdlod_init(&cdlod, CDLOD_LOD0_RANGE);
+	int bUseCdlod = FALSE;
+	int bWasLodModeKeyDown = FALSE;
+
+	OcclusionBuffer occlusionBuffer;
+	occlusion_init(&occlusionBuffer);
+
+	GutGpuTimer gpuTimer;
+	gut_gpu_timer_init(&gpuTimer);
+
+	// --record <path> saves the camera at every simulation step. --benchmark <path> draws such a recording
+	// back one step per frame, as fast as frames can be drawn, then logs how the frames went.
+	const char* benchmarkPath = get_option(argc, argv, "--benchmark");
+	const char* recordPath = benchmarkPath ? NULL : get_option(argc, argv, "--record");
+	CameraPath cameraPath;
+	camera_path_init(&cameraPath, SIMULATION_STEP_RATE);
+	if (benchmarkPath && !camera_path_load(&cameraPath, benchmarkPath))
+		LOGFATAL("Failed to load camera path %s.", benchmarkPath);
+	int nextCameraPathKey = 0;
+	Benchmark benchmark;
+	benchmark_init(&benchmark);
+
+	// Camera movement is simulated in fixed steps and drawn interpolated between the last two
+	FrameScheduler frameScheduler;
+	frame_scheduler_init(&frameScheduler, benchmarkPath ? 0 : TARGET_FPS, SIMULATION_STEP_RATE);
+	const float stepDeltaTime = (float)frameScheduler.stepDuration;
+	Vec3 previousCameraPosition, previousCameraForward;
+	mut_vec3_copy(&previousCameraPosition, &cameraPosition);
+	mut_vec3_copy(&previousCameraForward, &cameraForward);
+	float pendingMouseYaw = 0;
+	float pendingMousePitch = 0;
+
+#ifdef ENABLE_PROFILING
+	// --trace <path> writes every profiled scope to a Chrome trace file, P logs the last frame's profile
+	const char* tracePath = get_option(argc, argv, "--trace");
+	if (tracePath && !profiler_start_trace(tracePath))
+		LOG("Failed to open trace file %s.", tracePath);
+	int bWasProfileKeyDown = FALSE;
+#endif
 
 	int bIsRunning = TRUE;
 	while (bIsRunning)
 	{
-        clock_t now = clock();
-		float deltaTime = ((float) now - lastTickStart) / CLOCKS_PER_SEC;
-        lastTickStart = now;
+#ifdef ENABLE_PROFILING
+		profiler_end_frame();
+		for (int i = 0; i < gpuTimer.numRegions; ++i)
+			if (gpuTimer.regionTimes[i] > 0.0)
+				profiler_record_time(gpuTimer.regionNames[i], gpuTimer.regionTimes[i]);
+#endif
+		PROFILE_SCOPE("frame");
+		const double frameStartTime = platform_get_time();
+
+		// A benchmark takes the camera straight from its recording, with no steps to interpolate between
+		int numSteps = 0;
+		if (!benchmarkPath)
+			numSteps = frame_scheduler_begin_frame(&frameScheduler);
+		else if (nextCameraPathKey < cameraPath.numKeys)
+		{
+			const CameraPathKey* key = &cameraPath.keys[nextCameraPathKey++];
+			memcpy(cameraPosition.data, key->position, sizeof(key->position));
+			memcpy(cameraForward.data, key->forward, sizeof(key->forward));
+			mut_vec3_copy(&previousCameraPosition, &cameraPosition);
+			mut_vec3_copy(&previousCameraForward, &cameraForward);
+		}
+		else
+			break;
 
-		platform_window_flush_input(hWnd);
+		platform_window_flush_input(window);
 
 		if (!platform_process_events())
 			bIsRunning = FALSE;
 
-		const WindowInputState * input = platform_get_window_input_state(hWnd);
-
-		Vec3 cameraPositionOffset;
-		mut_vec3_init(&cameraPositionOffset);
-
-		if (input->keys[KEY_W].bIsDown)
-			cameraPositionOffset.z += CAMERA_SPEED;
-		if (input->keys[KEY_S].bIsDown)
-			cameraPositionOffset.z -= CAMERA_SPEED;
-		if (input->keys[KEY_A].bIsDown)
-			cameraPositionOffset.x += CAMERA_SPEED;
-		if (input->keys[KEY_D].bIsDown)
-			cameraPositionOffset.x -= CAMERA_SPEED;
-		if (input->keys[KEY_SPACE].bIsDown)
-			cameraPositionOffset.y += CAMERA_SPEED;
-		if (input->keys[KEY_LEFT_CONTROL].bIsDown)
-			cameraPositionOffset.y -= CAMERA_SPEED;
-
-		Vec3 cameraRight;
-		mut_vec3_cross(&cameraRight, &cameraUp, &cameraForward);
-
-		if (mut_vec3_magsq(&cameraPositionOffset) > 0)
-		{
-			mut_vec3_normalise(&cameraPositionOffset);
-			mut_vec3_multiplyf(&cameraPositionOffset, deltaTime);
-			if (input->keys[KEY_LEFT_SHIFT].bIsDown)
-				mut_vec3_multiplyf(&cameraPositionOffset, CAMERA_SPEED_BOOST_MULTIPLIER);
-
-			Vec3 offsetF, offsetR, offsetU;
-			mut_vec3_multiplyfc(&offsetF, &cameraForward, cameraPositionOffset.z);
-			mut_vec3_multiplyfc(&offsetR, &cameraRight, cameraPositionOffset.x);
-			mut_vec3_multiplyfc(&offsetU, &cameraUp, cameraPositionOffset.y);
-			mut_vec3_add(&cameraPosition, &offsetF);
-			mut_vec3_add(&cameraPosition, &offsetR);
-			mut_vec3_add(&cameraPosition, &offsetU);
-		}
+		const WindowInputState * input = platform_get_window_input_state(window);
 
-		float cameraPitchOffset = 0;
-		float cameraYawOffset = 0;
+		if (input->keys[KEY_L].bIsDown && !bWasLodModeKeyDown)
+			bUseCdlod = !bUseCdlod;
+		bWasLodModeKeyDown = input->keys[KEY_L].bIsDown;
 
-		if (input->keys[KEY_LEFT].bIsDown)
-			cameraYawOffset += CAMERA_TURN_SPEED * deltaTime;
-		if (input->keys[KEY_RIGHT].bIsDown)
-			cameraYawOffset -= CAMERA_TURN_SPEED * deltaTime;
-		if (input->keys[KEY_UP].bIsDown)
-			cameraPitchOffset -= CAMERA_TURN_SPEED * deltaTime;
-		if (input->keys[KEY_DOWN].bIsDown)
-			cameraPitchOffset += CAMERA_TURN_SPEED * deltaTime;
+#ifdef ENABLE_PROFILING
+		if (input->keys[KEY_P].bIsDown && !bWasProfileKeyDown)
+			profiler_log_summary();
+		bWasProfileKeyDown = input->keys[KEY_P].bIsDown;
+#endif
 
+		// Mouse movement is not scaled by time, so it is turned by in whole in the next step
 		if (input->mouse.buttons[MOUSE_BUTTON_LEFT].bIsDown)
 		{
-			if (input->mouse.deltaX != 0)
-				cameraYawOffset -= (float)input->mouse.deltaX * CAMERA_MOUSE_MULTIPLIER;
-			if (input->mouse.deltaY != 0)
-				cameraPitchOffset += (float)input->mouse.deltaY * CAMERA_MOUSE_MULTIPLIER;
+			pendingMouseYaw -= (float)input->mouse.deltaX * CAMERA_MOUSE_MULTIPLIER;
+			pendingMousePitch += (float)input->mouse.deltaY * CAMERA_MOUSE_MULTIPLIER;
 		}
 
-		if (cameraPitchOffset != 0 || cameraYawOffset != 0)
+		for (int step = 0; step < numSteps; ++step)
 		{
-			Quaternion pitchRotation;
-			mut_quat_from_axis_angle(&pitchRotation, &cameraRight, cameraPitchOffset);
-
-			Quaternion yawRotation;
-			mut_quat_from_axis_angle(&yawRotation, &cameraUp, cameraYawOffset);
-
-			Quaternion pitchYawRotation;
-			mut_quat_multiply(&pitchYawRotation, &pitchRotation, &yawRotation);
-			mut_quat_multiply_vec3(&cameraForward, &pitchYawRotation, &cameraForward);	
+			PROFILE_SCOPE("simulate_step");
+			mut_vec3_copy(&previousCameraPosition, &cameraPosition);
+			mut_vec3_copy(&previousCameraForward, &cameraForward);
+
+			Vec3 cameraPositionOffset;
+			mut_vec3_init(&cameraPositionOffset);
+
+			if (input->keys[KEY_W].bIsDown)
+				cameraPositionOffset.z += CAMERA_SPEED;
+			if (input->keys[KEY_S].bIsDown)
+				cameraPositionOffset.z -= CAMERA_SPEED;
+			if (input->keys[KEY_A].bIsDown)
+				cameraPositionOffset.x += CAMERA_SPEED;
+			if (input->keys[KEY_D].bIsDown)
+				cameraPositionOffset.x -= CAMERA_SPEED;
+			if (input->keys[KEY_SPACE].bIsDown)
+				cameraPositionOffset.y += CAMERA_SPEED;
+			if (input->keys[KEY_LEFT_CONTROL].bIsDown)
+				cameraPositionOffset.y -= CAMERA_SPEED;
+
+			Vec3 cameraRight;
+			mut_vec3_cross(&cameraRight, &cameraUp, &cameraForward);
+
+			if (mut_vec3_magsq(&cameraPositionOffset) > 0)
+			{
+				mut_vec3_normalise(&cameraPositionOffset);
+				mut_vec3_multiplyf(&cameraPositionOffset, stepDeltaTime);
+				if (input->keys[KEY_LEFT_SHIFT].bIsDown)
+					mut_vec3_multiplyf(&cameraPositionOffset, CAMERA_SPEED_BOOST_MULTIPLIER);
+
+				Vec3 offsetF, offsetR, offsetU;
+				mut_vec3_multiplyfc(&offsetF, &cameraForward, cameraPositionOffset.z);
+				mut_vec3_multiplyfc(&offsetR, &cameraRight, cameraPositionOffset.x);
+				mut_vec3_multiplyfc(&offsetU, &cameraUp, cameraPositionOffset.y);
+				mut_vec3_add(&cameraPosition, &offsetF);
+				mut_vec3_add(&cameraPosition, &offsetR);
+				mut_vec3_add(&cameraPosition, &offsetU);
+			}
+
+			float cameraPitchOffset = pendingMousePitch;
+			float cameraYawOffset = pendingMouseYaw;
+			pendingMousePitch = 0;
+			pendingMouseYaw = 0;
+
+			if (input->keys[KEY_LEFT].bIsDown)
+				cameraYawOffset += CAMERA_TURN_SPEED * stepDeltaTime;
+			if (input->keys[KEY_RIGHT].bIsDown)
+				cameraYawOffset -= CAMERA_TURN_SPEED * stepDeltaTime;
+			if (input->keys[KEY_UP].bIsDown)
+				cameraPitchOffset -= CAMERA_TURN_SPEED * stepDeltaTime;
+			if (input->keys[KEY_DOWN].bIsDown)
+				cameraPitchOffset += CAMERA_TURN_SPEED * stepDeltaTime;
+
+			if (cameraPitchOffset != 0 || cameraYawOffset != 0)
+			{
+				Quaternion pitchRotation;
+				mut_quat_from_axis_angle(&pitchRotation, &cameraRight, cameraPitchOffset);
+
+				Quaternion yawRotation;
+				mut_quat_from_axis_angle(&yawRotation, &cameraUp, cameraYawOffset);
+
+				Quaternion pitchYawRotation;
+				mut_quat_multiply(&pitchYawRotation, &pitchRotation, &yawRotation);
+				mut_quat_multiply_vec3(&cameraForward, &pitchYawRotation, &cameraForward);
+			}
+
+			if (recordPath)
+				camera_path_add(&cameraPath, cameraPosition.data, cameraForward.data);
 		}
 
-		elapsedSinceLastFrame += deltaTime;
-		if (elapsedSinceLastFrame < 1.0f / TARGET_FPS)
-			continue;
-
-		elapsedSinceLastFrame = 0;
+		const float stepAlpha = frame_scheduler_get_step_alpha(&frameScheduler);
+		Vec3 eyePosition, eyeForward;
+		mut_vec3_lerp(&eyePosition, &previousCameraPosition, &cameraPosition, stepAlpha);
+		mut_vec3_lerp(&eyeForward, &previousCameraForward, &cameraForward, stepAlpha);
 
 		Mat4 view;
 		Vec3 lookat;
-		mut_vec3_addc(&lookat, &cameraPosition, &cameraForward);
-		mut_mat4_lookat(&view, &cameraPosition, &lookat, &cameraUp);
+		mut_vec3_addc(&lookat, &eyePosition, &eyeForward);
+		mut_mat4_lookat(&view, &eyePosition, &lookat, &cameraUp);
 		
 		Mat4 projection;
-		mut_mat4_perspective(&projection, mut_radians(CAMERA_VFOV), (float)WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, 1000.0f);
+		const float farPlane = bUseCdlod ? cdlod.lodRanges[CDLOD_NUM_LODS - 1] : 1000.0f;
+		mut_mat4_perspective(&projection, mut_radians(CAMERA_VFOV), (float)WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, farPlane);
+
+		// mut_mat4_multiply(out, lhs, rhs) stores rhs * lhs
+		Mat4 clip;
+		mut_mat4_multiply(&clip, &view, &projection);
+		Frustum frustum;
+		mut_frustum_from_mat4(&frustum, &clip);
+
+		if (bUseCdlod)
+		{
+			PROFILE_SCOPE("cdlod_select");
+			cdlod_select(&cdlod, eyePosition.x, eyePosition.y, eyePosition.z, frustum.planes[0].data);
+		}
+		else
+		{
+			PROFILE_SCOPE("terrain_update");
+			terrain_chunk_grid_update(&terrainGrid, &terrainGenerator, eyePosition.x, eyePosition.z);
+
+			const double uploadDeadline = platform_get_time() + TERRAIN_UPLOAD_BUDGET;
+			double chunkLatency;
+			while (platform_get_time() < uploadDeadline && terrain_generator_upload_one(&terrainGenerator, &chunkLatency))
+				if (benchmarkPath && chunkLatency >= 0.0)
+					benchmark_add_sample(&benchmark.chunkLatencies, chunkLatency);
+			terrain_generator_end_frame(&terrainGenerator);
+
+			const float lodErrorScale = WINDOW_HEIGHT / (2.0f * tanf(mut_radians(CAMERA_VFOV) * 0.5f) * TERRAIN_LOD_PIXEL_ERROR);
+			terrain_chunk_grid_select_lods(&terrainGrid, eyePosition.x, eyePosition.y, eyePosition.z, lodErrorScale);
+		}
 
 		Vec3 lightDirection = { 1.0f, -1.0f, 1.0f };
 
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glUseProgram(state.shaderProgram.glHandle);
+		FrameUniforms frameUniforms;
+		memcpy(frameUniforms.projectionMatrix, projection.data, sizeof(frameUniforms.projectionMatrix));
+		memcpy(frameUniforms.viewMatrix, view.data, sizeof(frameUniforms.viewMatrix));
+		memcpy(frameUniforms.lightDirection, lightDirection.data, sizeof(frameUniforms.lightDirection));
+		memcpy(frameUniforms.cameraPosition, eyePosition.data, sizeof(frameUniforms.cameraPosition));
+		glBindBuffer(GL_UNIFORM_BUFFER, state.glFrameUniformBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameUniforms), &frameUniforms);
 
-		gut_set_shader_uniform(state.shaderProgram.glHandle, GL_FLOAT_MAT4, "u_ProjectionMatrix", projection.data);
-		gut_set_shader_uniform(state.shaderProgram.glHandle, GL_FLOAT_MAT4, "u_ViewMatrix", view.data);
-		gut_set_shader_uniform(state.shaderProgram.glHandle, GL_FLOAT_VEC3, "u_LightDirection", lightDirection.data);
+		GutShaderProgram* program = bUseCdlod ? &state.cdlodShaderProgram : &state.shaderProgram;
+		if (!use_shader_program(program))
+			LOGFATAL("Failed to build shader program.");
 
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-		mesh_draw_indexed(&chunk.mesh);
+		if (bUseCdlod)
+		{
+			PROFILE_SCOPE("cdlod_draw");
+			gut_gpu_timer_begin(&gpuTimer, "gpu_cdlod_draw");
+			cdlod_draw(&cdlod, program);
+			gut_gpu_timer_end(&gpuTimer);
+		}
+		else
+		{
+			PROFILE_SCOPE("terrain_draw");
+			const int numChunks = terrainGrid.size * terrainGrid.size;
+			terrain_chunk_grid_update_bounds(&terrainGrid);
+			AABBArrays chunkBounds = {
+				terrainGrid.boundsMinX, terrainGrid.boundsMinY, terrainGrid.boundsMinZ,
+				terrainGrid.boundsMaxX, terrainGrid.boundsMaxY, terrainGrid.boundsMaxZ,
+				numChunks
+			};
+			unsigned char bIsChunkVisible[numChunks];
+			mut_frustum_cull_aabbs(&frustum, &chunkBounds, bIsChunkVisible);
+
+			// Nearby terrain hides much of what is behind it in hilly areas, so the nearest chunks are
+			// rasterised into a small depth buffer and every chunk's bounds tested against it
+			occlusion_clear(&occlusionBuffer, clip.data);
+			for (int i = 0; i < numChunks; ++i)
+			{
+				const TerrainChunk* chunk = &terrainGrid.chunks[i];
+				if (chunk->bIsMeshReady && bIsChunkVisible[i] &&
+					abs(chunk->x - terrainGrid.centreX) <= TERRAIN_OCCLUDER_DISTANCE &&
+					abs(chunk->z - terrainGrid.centreZ) <= TERRAIN_OCCLUDER_DISTANCE)
+					terrain_rasterise_chunk_occluder(chunk, &occlusionBuffer);
+			}
+
+			for (int i = 0; i < numChunks; ++i)
+			{
+				const TerrainChunk* chunk = &terrainGrid.chunks[i];
+				if (!chunk->bIsMeshReady || !bIsChunkVisible[i])
+					continue;
+
+				const float boundsMin[3] = { terrainGrid.boundsMinX[i], terrainGrid.boundsMinY[i], terrainGrid.boundsMinZ[i] };
+				const float boundsMax[3] = { terrainGrid.boundsMaxX[i], terrainGrid.boundsMaxY[i], terrainGrid.boundsMaxZ[i] };
+				if (!occlusion_test_box(&occlusionBuffer, boundsMin, boundsMax))
+					continue;
+
+				terrain_queue_chunk_draw(chunk);
+			}
+			gut_gpu_timer_begin(&gpuTimer, "gpu_terrain_draw");
+			terrain_draw_queued_chunks();
+			gut_gpu_timer_end(&gpuTimer);
+		}
 		
-		SwapBuffers(hDeviceContext);
+		{
+			PROFILE_SCOPE("swap_buffers");
+			platform_swap_buffers(window);
+		}
+		gut_gpu_timer_end_frame(&gpuTimer);
+
+		if (benchmarkPath)
+			benchmark_end_frame(&benchmark, platform_get_time() - frameStartTime);
+
+		PROFILE_SCOPE("wait");
+		frame_scheduler_wait(&frameScheduler);
 	}
 
+	if (benchmarkPath)
+		benchmark_log_report(&benchmark);
+	if (recordPath && !camera_path_save(&cameraPath, recordPath))
+		LOG("Failed to save camera path %s.", recordPath);
+
+	terrain_generator_destroy(&terrainGenerator);
+	terrain_chunk_grid_destroy(&terrainGrid);
+	terrain_destroy_gpu_buffers();
+	cdlod_destroy(&cdlod);
+	occlusion_destroy(&occlusionBuffer);
+	gut_gpu_timer_destroy(&gpuTimer);
+	camera_path_destroy(&cameraPath);
+	benchmark_destroy(&benchmark);
+	gut_destroy_shader_program(&state.shaderProgram);
+	gut_destroy_shader_program(&state.cdlodShaderProgram);
+	glDeleteBuffers(1, &state.glFrameUniformBuffer);
+#ifdef ENABLE_PROFILING
+	profiler_destroy();
+#endif
+	platform_destroy_window(window);
+
 	return 0;
 }
\ No newline at end of file
@@ -6,6 +6,11 @@
 #include "macromagic.h"
 #include "math.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE__)
+#define MUT_SIMD_X86
+#include <immintrin.h>
+#endif
+
 #define MUT_TAU 6.283185307179586
 #define MUT_PI 3.141592653589793
 
@@ -70,6 +75,8 @@ DEFINE_VEC_OP_FUNCS(N, /, divide)\
 void mut_vec##N##_inverse(Vec##N* out, Vec##N const* v) {\
 	mut_vec##N##_copy(out, v);\
 	mut_vec##N##_multiplyf(out, -1); }\
+void mut_vec##N##_lerp(Vec##N* out, Vec##N const* from, Vec##N const* to, float t) {\
+	for (int n = 0; n < N; ++n) out->data[n] = from->data[n] + (to->data[n] - from->data[n]) * t; }\
 float mut_vec##N##_dot(Vec##N const* lhs, Vec##N const* rhs) {\
 	float dot = 0;\
 	for (int n = 0; n < N; ++n)\
@@ -246,6 +253,150 @@ void mut_mat4_lookat(Mat4* out, const Vec3* eye, const Vec3* target, const Vec3*
 	out->data[15] = 1.0f;
 }
 
+typedef struct AABB
+{
+	Vec3 min;
+	Vec3 max;
+} AABB;
+
+// Axis-aligned boxes with one array per bound component, the layout mut_frustum_cull_aabbs loads four or
+// eight boxes at a time from
+typedef struct AABBArrays
+{
+	float* minX;
+	float* minY;
+	float* minZ;
+	float* maxX;
+	float* maxY;
+	float* maxZ;
+	int count;
+} AABBArrays;
+
+// Planes are (a, b, c, d) with the inside where ax + by + cz + d >= 0, in the order left, right, bottom,
+// top, near, far
+typedef struct Frustum
+{
+	Vec4 planes[6];
+} Frustum;
+
+// Extracts the planes from a projection * view matrix (Gribb & Hartmann), in world space
+void mut_frustum_from_mat4(Frustum* out, const Mat4* clip)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		// Row 3 plus or minus row 0, 1 or 2; data is column-major
+		const int row = p / 2;
+		const float sign = p % 2 ? -1.0f : 1.0f;
+		for (int n = 0; n < 4; ++n)
+			out->planes[p].data[n] = clip->data[n * 4 + 3] + sign * clip->data[n * 4 + row];
+
+		Vec3 normal = { out->planes[p].x, out->planes[p].y, out->planes[p].z };
+		mut_vec4_dividef(&out->planes[p], mut_vec3_mag(&normal));
+	}
+}
+
+int mut_frustum_intersects_aabb(const Frustum* frustum, const AABB* box)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		// Only the corner furthest along the plane normal needs testing
+		const Vec4* plane = &frustum->planes[p];
+		const float x = plane->x >= 0.0f ? box->max.x : box->min.x;
+		const float y = plane->y >= 0.0f ? box->max.y : box->min.y;
+		const float z = plane->z >= 0.0f ? box->max.z : box->min.z;
+		if (plane->x * x + plane->y * y + plane->z * z + plane->w < 0.0f)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// Picks the box corner furthest along each plane's normal, which is a whole array per plane in SoA form
+#define MUT_FRUSTUM_PLANE_CORNERS(plane, boxes)\
+	const float* px = (plane)->x >= 0.0f ? (boxes)->maxX : (boxes)->minX;\
+	const float* py = (plane)->y >= 0.0f ? (boxes)->maxY : (boxes)->minY;\
+	const float* pz = (plane)->z >= 0.0f ? (boxes)->maxZ : (boxes)->minZ;
+
+void mut_frustum_cull_aabbs_scalar(const Frustum* frustum, const AABBArrays* boxes, int start, unsigned char* outVisible)
+{
+	for (int i = start; i < boxes->count; ++i)
+		outVisible[i] = TRUE;
+
+	for (int p = 0; p < 6; ++p)
+	{
+		const Vec4* plane = &frustum->planes[p];
+		MUT_FRUSTUM_PLANE_CORNERS(plane, boxes)
+		for (int i = start; i < boxes->count; ++i)
+			if (plane->x * px[i] + plane->y * py[i] + plane->z * pz[i] + plane->w < 0.0f)
+				outVisible[i] = FALSE;
+	}
+}
+
+#ifdef MUT_SIMD_X86
+
+// Returns the number of boxes handled, a multiple of 4
+int mut_frustum_cull_aabbs_sse(const Frustum* frustum, const AABBArrays* boxes, unsigned char* outVisible)
+{
+	const int count = boxes->count & ~3;
+	for (int i = 0; i < count; i += 4)
+	{
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			const Vec4* plane = &frustum->planes[p];
+			MUT_FRUSTUM_PLANE_CORNERS(plane, boxes)
+			const __m128 d = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane->x), _mm_loadu_ps(px + i)), _mm_mul_ps(_mm_set1_ps(plane->y), _mm_loadu_ps(py + i))),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane->z), _mm_loadu_ps(pz + i)), _mm_set1_ps(plane->w)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+		}
+
+		const int mask = _mm_movemask_ps(outside);
+		for (int k = 0; k < 4; ++k)
+			outVisible[i + k] = !((mask >> k) & 1);
+	}
+	return count;
+}
+
+__attribute__((target("avx")))
+int mut_frustum_cull_aabbs_avx(const Frustum* frustum, const AABBArrays* boxes, unsigned char* outVisible)
+{
+	const int count = boxes->count & ~7;
+	for (int i = 0; i < count; i += 8)
+	{
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			const Vec4* plane = &frustum->planes[p];
+			MUT_FRUSTUM_PLANE_CORNERS(plane, boxes)
+			const __m256 d = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane->x), _mm256_loadu_ps(px + i)), _mm256_mul_ps(_mm256_set1_ps(plane->y), _mm256_loadu_ps(py + i))),
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane->z), _mm256_loadu_ps(pz + i)), _mm256_set1_ps(plane->w)));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+
+		const int mask = _mm256_movemask_ps(outside);
+		for (int k = 0; k < 8; ++k)
+			outVisible[i + k] = !((mask >> k) & 1);
+	}
+	return count;
+}
+
+#endif
+
+// Writes TRUE to outVisible[i] for every box that intersects the frustum. Boxes are tested eight at a
+// time with AVX, or four with SSE, and any left over one at a time.
+void mut_frustum_cull_aabbs(const Frustum* frustum, const AABBArrays* boxes, unsigned char* outVisible)
+{
+	int done = 0;
+#ifdef MUT_SIMD_X86
+	if (__builtin_cpu_supports("avx"))
+		done = mut_frustum_cull_aabbs_avx(frustum, boxes, outVisible);
+	else
+		done = mut_frustum_cull_aabbs_sse(frustum, boxes, outVisible);
+#endif
+	mut_frustum_cull_aabbs_scalar(frustum, boxes, done, outVisible);
+}
+
 typedef struct Quaternion
 {
 	float x, y, z, w;
@@ -1,19 +1,22 @@
 #include "glutils.h"
 #include "macromagic.h"
 #include "mesh.h"
+#include "profiler.h"
+
+MeshDrawStats meshDrawStats;
 
 size_t calculate_vertex_size(const MeshVertexAttribute* vertexAttributes, int numVertexAttributes)
 {
     int size = 0;
     for (int i = 0; i < numVertexAttributes; ++i)
-        size += vertexAttributes[i].count * gut_get_type_size(vertexAttributes[i].glType);
+        size += gut_get_attribute_size(vertexAttributes[i].glType, vertexAttributes[i].count);
     return size;
 }
 
 void mesh_allocate_mesh_data(MeshData* meshData)
 {
     size_t vertexSize = calculate_vertex_size(meshData->vertexAttributes, meshData->numVertexAttributes);
-	meshData->vertices = (float*)malloc(vertexSize * meshData->numVertices);
+	meshData->vertices = malloc(vertexSize * meshData->numVertices);
 	meshData->indices = meshData->numIndices == 0 ? NULL : (unsigned int*)malloc(sizeof(unsigned int) * meshData->numIndices);
 }
 
@@ -23,44 +26,53 @@ void mesh_free_mesh_data(MeshData* meshData)
 	free(meshData->indices);
 }
 
+// Describes the interleaved layout of the currently bound GL_ARRAY_BUFFER to the currently bound VAO
+void setup_vertex_attributes(const MeshVertexAttribute* vertexAttributes, int numVertexAttributes, size_t vertexSize)
+{
+    size_t offset = 0;
+    for (GLuint a = 0; a < numVertexAttributes; ++a)
+    {
+        if (vertexAttributes[a].bIntegerStorage)
+            glVertexAttribIPointer(a,
+                (GLint)vertexAttributes[a].count,
+                vertexAttributes[a].glType,
+                (GLsizei)vertexSize,
+                (void*)offset);
+        else
+            glVertexAttribPointer(a,
+                (GLint)vertexAttributes[a].count,
+                vertexAttributes[a].glType,
+                vertexAttributes[a].bNormalised ? GL_TRUE : GL_FALSE,
+                (GLsizei)vertexSize,
+                (void*)offset);
+        glEnableVertexAttribArray(a);
+        offset += gut_get_attribute_size(vertexAttributes[a].glType, vertexAttributes[a].count);
+    }
+}
+
 void mesh_create(Mesh* out, const MeshData* meshData)
 {
+    PROFILE_SCOPE("mesh_create");
     glGenVertexArrays(1, &out->glVao);
     glBindVertexArray(out->glVao);
 
     const size_t vertexSize = calculate_vertex_size(meshData->vertexAttributes, meshData->numVertexAttributes);
 
-    gut_create_buffer(&out->glVbo, vertexSize * meshData->numVertices, meshData->vertices, GL_STATIC_DRAW);
+    gut_create_buffer(&out->glVbo, GL_ARRAY_BUFFER, vertexSize * meshData->numVertices, meshData->vertices, GL_STATIC_DRAW);
 
+    // The element buffer binding is VAO state, so it has to go to GL_ELEMENT_ARRAY_BUFFER while the VAO is bound
     if (meshData->numIndices)
     {
-        gut_create_buffer(&out->glIbo, sizeof(unsigned int) * meshData->numIndices, meshData->indices, GL_STATIC_DRAW);
+        gut_create_buffer(&out->glIbo, GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * meshData->numIndices, meshData->indices, GL_STATIC_DRAW);
 	    out->numElements = meshData->numIndices;
     }
     else
     {
+        out->glIbo = 0;
 	    out->numElements = meshData->numVertices;
     }
 
-    size_t offset = 0;
-    for (GLuint a = 0; a < meshData->numVertexAttributes; ++a)
-    {
-        if (meshData->vertexAttributes[a].bIntegerStorage)
-            glVertexAttribIPointer(a,
-                (GLint)meshData->vertexAttributes[a].count,
-                meshData->vertexAttributes[a].glType,
-                (GLsizei)vertexSize,
-                (void*)offset);
-        else
-            glVertexAttribPointer(a,
-                (GLint)meshData->vertexAttributes[a].count,
-                meshData->vertexAttributes[a].glType,
-                meshData->vertexAttributes[a].bNormalised ? GL_TRUE : GL_FALSE,
-                (GLsizei)vertexSize,
-                (void*)offset);
-        glEnableVertexAttribArray(a);
-        offset += meshData->vertexAttributes[a].count * gut_get_type_size(meshData->vertexAttributes[a].glType);
-    }
+    setup_vertex_attributes(meshData->vertexAttributes, meshData->numVertexAttributes, vertexSize);
 }
 
 void mesh_destroy(Mesh* out)
@@ -74,12 +86,217 @@ void mesh_draw_indexed(const Mesh* mesh)
 {
     glBindVertexArray(mesh->glVao);
     glDrawElements(GL_TRIANGLES, mesh->numElements, GL_UNSIGNED_INT, 0);
+    meshDrawStats.numDrawCalls++;
+    meshDrawStats.numDraws++;
+    meshDrawStats.numTriangles += mesh->numElements / 3;
 }
 
 void mesh_draw_unindexed(const Mesh* mesh)
 {
     glBindVertexArray(mesh->glVao);
     glDrawArrays(GL_POINTS, 0, mesh->numElements);
+    meshDrawStats.numDrawCalls++;
+    meshDrawStats.numDraws++;
+}
+
+void free_list_init(MeshArenaFreeList* out, unsigned int capacity)
+{
+    out->capacity = 16;
+    out->ranges = (MeshArenaRange*)malloc(sizeof(MeshArenaRange) * out->capacity);
+    out->ranges[0].offset = 0;
+    out->ranges[0].count = capacity;
+    out->numRanges = capacity ? 1 : 0;
+}
+
+int free_list_allocate(MeshArenaFreeList* list, unsigned int count, MeshArenaRange* out)
+{
+    for (int i = 0; i < list->numRanges; ++i)
+    {
+        MeshArenaRange* range = &list->ranges[i];
+        if (range->count < count)
+            continue;
+
+        out->offset = range->offset;
+        out->count = count;
+        range->offset += count;
+        range->count -= count;
+        if (range->count == 0)
+        {
+            for (int j = i + 1; j < list->numRanges; ++j)
+                list->ranges[j - 1] = list->ranges[j];
+            list->numRanges--;
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void free_list_free(MeshArenaFreeList* list, const MeshArenaRange* range)
+{
+    if (range->count == 0)
+        return;
+
+    int i = 0;
+    while (i < list->numRanges && list->ranges[i].offset < range->offset)
+        ++i;
+
+    const int bJoinsPrevious = i > 0 && list->ranges[i - 1].offset + list->ranges[i - 1].count == range->offset;
+    const int bJoinsNext = i < list->numRanges && range->offset + range->count == list->ranges[i].offset;
+
+    if (bJoinsPrevious && bJoinsNext)
+    {
+        list->ranges[i - 1].count += range->count + list->ranges[i].count;
+        for (int j = i + 1; j < list->numRanges; ++j)
+            list->ranges[j - 1] = list->ranges[j];
+        list->numRanges--;
+    }
+    else if (bJoinsPrevious)
+        list->ranges[i - 1].count += range->count;
+    else if (bJoinsNext)
+    {
+        list->ranges[i].offset = range->offset;
+        list->ranges[i].count += range->count;
+    }
+    else
+    {
+        if (list->numRanges == list->capacity)
+        {
+            list->capacity *= 2;
+            list->ranges = (MeshArenaRange*)realloc(list->ranges, sizeof(MeshArenaRange) * list->capacity);
+        }
+        for (int j = list->numRanges; j > i; --j)
+            list->ranges[j] = list->ranges[j - 1];
+        list->ranges[i] = *range;
+        list->numRanges++;
+    }
+}
+
+void mesh_arena_init(MeshArena* out, const MeshVertexAttribute* vertexAttributes, int numVertexAttributes, unsigned int vertexCapacity, unsigned int indexCapacity)
+{
+    out->vertexSize = calculate_vertex_size(vertexAttributes, numVertexAttributes);
+    free_list_init(&out->freeVertices, vertexCapacity);
+    free_list_init(&out->freeIndices, indexCapacity);
+
+    glGenVertexArrays(1, &out->glVao);
+    glBindVertexArray(out->glVao);
+    gut_create_buffer(&out->glVbo, GL_ARRAY_BUFFER, out->vertexSize * vertexCapacity, NULL, GL_DYNAMIC_DRAW);
+    gut_create_buffer(&out->glIbo, GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexCapacity, NULL, GL_STATIC_DRAW);
+    setup_vertex_attributes(vertexAttributes, numVertexAttributes, out->vertexSize);
+}
+
+void mesh_arena_destroy(MeshArena* arena)
+{
+    glDeleteVertexArrays(1, &arena->glVao);
+    glDeleteBuffers(1, &arena->glVbo);
+    glDeleteBuffers(1, &arena->glIbo);
+    free(arena->freeVertices.ranges);
+    free(arena->freeIndices.ranges);
+}
+
+int mesh_arena_allocate_vertices(MeshArena* arena, unsigned int count, MeshArenaRange* out)
+{
+    return free_list_allocate(&arena->freeVertices, count, out);
+}
+
+int mesh_arena_allocate_indices(MeshArena* arena, unsigned int count, MeshArenaRange* out)
+{
+    return free_list_allocate(&arena->freeIndices, count, out);
+}
+
+void mesh_arena_free_vertices(MeshArena* arena, const MeshArenaRange* range)
+{
+    free_list_free(&arena->freeVertices, range);
+}
+
+void mesh_arena_free_indices(MeshArena* arena, const MeshArenaRange* range)
+{
+    free_list_free(&arena->freeIndices, range);
+}
+
+void mesh_arena_upload_vertices(const MeshArena* arena, const MeshArenaRange* range, const void* vertices)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, arena->glVbo);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(arena->vertexSize * range->offset), (GLsizeiptr)(arena->vertexSize * range->count), vertices);
+}
+
+void mesh_arena_upload_indices(const MeshArena* arena, const MeshArenaRange* range, const unsigned int* indices)
+{
+    // Not GL_ELEMENT_ARRAY_BUFFER, that binding belongs to whichever VAO happens to be bound
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena->glIbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)(sizeof(unsigned int) * range->offset), (GLsizeiptr)(sizeof(unsigned int) * range->count), indices);
+}
+
+void mesh_arena_bind(const MeshArena* arena)
+{
+    glBindVertexArray(arena->glVao);
+}
+
+void mesh_arena_draw_list_init(MeshArenaDrawList* out, int capacity)
+{
+    out->capacity = capacity > 0 ? capacity : 1;
+    out->commands = (MeshArenaDrawCommand*)malloc(sizeof(MeshArenaDrawCommand) * out->capacity);
+    out->numCommands = 0;
+    out->glIndirectBuffer = 0;
+    if (gutExtensions.glMultiDrawElementsIndirect)
+        gut_create_buffer(&out->glIndirectBuffer, GL_DRAW_INDIRECT_BUFFER, sizeof(MeshArenaDrawCommand) * out->capacity, NULL, GL_STREAM_DRAW);
+}
+
+void mesh_arena_draw_list_destroy(MeshArenaDrawList* list)
+{
+    free(list->commands);
+    list->commands = NULL;
+    if (list->glIndirectBuffer)
+        glDeleteBuffers(1, &list->glIndirectBuffer);
+}
+
+void mesh_arena_draw_list_add(MeshArenaDrawList* list, const MeshArenaRange* indices, const MeshArenaRange* vertices)
+{
+    if (list->numCommands == list->capacity)
+    {
+        list->capacity *= 2;
+        list->commands = (MeshArenaDrawCommand*)realloc(list->commands, sizeof(MeshArenaDrawCommand) * list->capacity);
+    }
+
+    MeshArenaDrawCommand* command = &list->commands[list->numCommands++];
+    command->count = indices->count;
+    command->instanceCount = 1;
+    command->firstIndex = indices->offset;
+    command->baseVertex = (GLint)vertices->offset;
+    command->baseInstance = 0;
+}
+
+void mesh_arena_draw_list_submit(MeshArenaDrawList* list)
+{
+    const int numCommands = list->numCommands;
+    list->numCommands = 0;
+    if (numCommands == 0)
+        return;
+
+    meshDrawStats.numDrawCalls++;
+    meshDrawStats.numDraws += numCommands;
+    for (int i = 0; i < numCommands; ++i)
+        meshDrawStats.numTriangles += list->commands[i].count / 3;
+
+    if (list->glIndirectBuffer)
+    {
+        // Orphaned every frame, so the upload never waits on last frame's draws still reading it
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list->glIndirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, (GLsizeiptr)(sizeof(MeshArenaDrawCommand) * list->capacity), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, (GLsizeiptr)(sizeof(MeshArenaDrawCommand) * numCommands), list->commands);
+        gutExtensions.glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, numCommands, 0);
+        return;
+    }
+
+    GLsizei counts[numCommands];
+    const void* offsets[numCommands];
+    GLint baseVertices[numCommands];
+    for (int i = 0; i < numCommands; ++i)
+    {
+        counts[i] = (GLsizei)list->commands[i].count;
+        offsets[i] = (const void*)(sizeof(unsigned int) * list->commands[i].firstIndex);
+        baseVertices[i] = list->commands[i].baseVertex;
+    }
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, numCommands, baseVertices);
 }
 
 // void mesh_generate_cube(Mesh * out)
@@ -22,12 +22,62 @@ typedef struct MeshVertexAttribute {
 typedef struct MeshData {
     MeshVertexAttribute* vertexAttributes;
     int numVertexAttributes;
-	float* vertices;
+	void* vertices; // interleaved, laid out as described by vertexAttributes
 	int numVertices;
 	unsigned int* indices;
 	int numIndices;
 } MeshData;
 
+typedef struct MeshArenaRange {
+    unsigned int offset; // in vertices or indices
+    unsigned int count;
+} MeshArenaRange;
+
+// Free ranges sorted by offset, neighbours are merged as ranges are returned
+typedef struct MeshArenaFreeList {
+    MeshArenaRange* ranges;
+    int numRanges;
+    int capacity;
+} MeshArenaFreeList;
+
+// One vertex buffer and one index buffer sub-allocated between many meshes of the same vertex layout.
+// They all draw through one VAO, so switching between them costs no binds. Indices in a range are
+// relative to the vertex range they are drawn with, which is passed as the base vertex.
+typedef struct MeshArena {
+    GLuint glVao;
+    GLuint glVbo;
+    GLuint glIbo;
+    size_t vertexSize;
+    MeshArenaFreeList freeVertices;
+    MeshArenaFreeList freeIndices;
+} MeshArena;
+
+// Laid out as GL's DrawElementsIndirectCommand
+typedef struct MeshArenaDrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} MeshArenaDrawCommand;
+
+// Draws from one arena gathered over a frame and submitted together in a single multi-draw call
+typedef struct MeshArenaDrawList {
+    MeshArenaDrawCommand* commands;
+    int numCommands;
+    int capacity;
+    GLuint glIndirectBuffer; // 0 when the context lacks multi-draw indirect
+} MeshArenaDrawList;
+
+// Counted by every draw function below. Nothing resets them, whoever reads them does, e.g. once a frame.
+typedef struct MeshDrawStats {
+    unsigned int numDrawCalls; // GL calls, a multi-draw counts once
+    unsigned int numDraws; // counting each draw in a multi-draw
+    unsigned long long numTriangles;
+} MeshDrawStats;
+
+extern MeshDrawStats meshDrawStats;
+
 void mesh_allocate_mesh_data(MeshData* meshData);
 
 void mesh_free_mesh_data(MeshData* meshData);
@@ -40,4 +90,37 @@ void mesh_draw_indexed(const Mesh* mesh);
 
 void mesh_draw_unindexed(const Mesh* mesh);
 
+void mesh_arena_init(MeshArena* out, const MeshVertexAttribute* vertexAttributes, int numVertexAttributes, unsigned int vertexCapacity, unsigned int indexCapacity);
+
+void mesh_arena_destroy(MeshArena* arena);
+
+// First fit; returns FALSE if no free range is big enough
+int mesh_arena_allocate_vertices(MeshArena* arena, unsigned int count, MeshArenaRange* out);
+
+int mesh_arena_allocate_indices(MeshArena* arena, unsigned int count, MeshArenaRange* out);
+
+void mesh_arena_free_vertices(MeshArena* arena, const MeshArenaRange* range);
+
+void mesh_arena_free_indices(MeshArena* arena, const MeshArenaRange* range);
+
+// Fills a whole range. vertices are interleaved in the arena's layout.
+void mesh_arena_upload_vertices(const MeshArena* arena, const MeshArenaRange* range, const void* vertices);
+
+void mesh_arena_upload_indices(const MeshArena* arena, const MeshArenaRange* range, const unsigned int* indices);
+
+void mesh_arena_bind(const MeshArena* arena);
+
+void mesh_arena_draw_list_init(MeshArenaDrawList* out, int capacity);
+
+void mesh_arena_draw_list_destroy(MeshArenaDrawList* list);
+
+// Queues triangles from indices, drawn with vertices' offset as the base vertex. The list grows past its
+// initial capacity if needed.
+void mesh_arena_draw_list_add(MeshArenaDrawList* list, const MeshArenaRange* indices, const MeshArenaRange* vertices);
+
+// Draws everything queued from the bound arena and empties the list. Uses glMultiDrawElementsIndirect
+// where available and glMultiDrawElementsBaseVertex otherwise; either way gl_DrawID is unavailable to
+// GLSL 3.30, so shaders tell draws apart by gl_VertexID, which includes the base vertex.
+void mesh_arena_draw_list_submit(MeshArenaDrawList* list);
+
 #endif
\ No newline at end of file
@@ -1,26 +1,63 @@
 #ifndef NOISE_H
 #define NOISE_H
 
+#include <stdlib.h>
+
 int fastfloor(float fp) {
     int i = fp;
     return (fp < i) ? (i - 1) : (i);
 }
 
-const unsigned char perm[256] = {
-    151, 160, 137, 91, 90, 15,
-    131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36, 103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23,
-    190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32, 57, 177, 33,
-    88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175, 74, 165, 71, 134, 139, 48, 27, 166,
-    77, 146, 158, 231, 83, 111, 229, 122, 60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244,
-    102, 143, 54, 65, 25, 63, 161, 1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169, 200, 196,
-    135, 130, 116, 188, 159, 86, 164, 100, 109, 198, 173, 186, 3, 64, 52, 217, 226, 250, 124, 123,
-    5, 202, 38, 147, 118, 126, 255, 82, 85, 212, 207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42,
-    223, 183, 170, 213, 119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155, 167, 43, 172, 9,
-    129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178, 185, 112, 104, 218, 246, 97, 228,
-    251, 34, 242, 193, 238, 210, 144, 12, 191, 179, 162, 241, 81, 51, 145, 235, 249, 14, 239, 107,
-    49, 192, 214, 31, 181, 199, 106, 157, 184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254,
+#define NOISE_PERM_TABLE \
+    151, 160, 137, 91, 90, 15, \
+    131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36, 103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23, \
+    190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32, 57, 177, 33, \
+    88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175, 74, 165, 71, 134, 139, 48, 27, 166, \
+    77, 146, 158, 231, 83, 111, 229, 122, 60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244, \
+    102, 143, 54, 65, 25, 63, 161, 1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169, 200, 196, \
+    135, 130, 116, 188, 159, 86, 164, 100, 109, 198, 173, 186, 3, 64, 52, 217, 226, 250, 124, 123, \
+    5, 202, 38, 147, 118, 126, 255, 82, 85, 212, 207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42, \
+    223, 183, 170, 213, 119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155, 167, 43, 172, 9, \
+    129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178, 185, 112, 104, 218, 246, 97, 228, \
+    251, 34, 242, 193, 238, 210, 144, 12, 191, 179, 162, 241, 81, 51, 145, 235, 249, 14, 239, 107, \
+    49, 192, 214, 31, 181, 199, 106, 157, 184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254, \
     138, 236, 205, 93, 222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180
-};
+
+const unsigned char perm[256] = { NOISE_PERM_TABLE };
+
+// Permutation table used by the *_ctx functions. The 256 entries are stored twice so that nested
+// lookups like perm[i + perm[j]] (with i, j already in [0, 255]) never need masking. Entries are ints
+// so the AVX2 batch kernel can gather straight from the table.
+typedef struct NoiseContext {
+    int perm[512];
+} NoiseContext;
+
+// Context built from the classic table above; the functions without a context use it
+const NoiseContext noise_default_context = { { NOISE_PERM_TABLE, NOISE_PERM_TABLE } };
+
+// Shuffles the identity permutation with a xorshift generator seeded from seed. This is just 255
+// swaps and a copy, so building a context per world is cheap.
+void noise_context_init(NoiseContext* ctx, unsigned int seed) {
+    unsigned int state = seed * 747796405u + 2891336453u;
+    if (state == 0)
+        state = 1;
+
+    for (int i = 0; i < 256; i++)
+        ctx->perm[i] = i;
+
+    for (int i = 255; i > 0; i--) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        const int j = (int)(state % (unsigned int)(i + 1));
+        const int tmp = ctx->perm[i];
+        ctx->perm[i] = ctx->perm[j];
+        ctx->perm[j] = tmp;
+    }
+
+    for (int i = 0; i < 256; i++)
+        ctx->perm[256 + i] = ctx->perm[i];
+}
 
 unsigned char hash(int i) {
     return perm[(unsigned char)i];
@@ -48,6 +85,15 @@ float grad2d(int hash, float x, float y) {
     return ((h & 1) ? -u : u) + ((h & 2) ? -2.0f * v : 2.0f * v); // and compute the dot product with (x,y).
 }
 
+// The gradient grad2d() dots with (x,y), for analytic derivatives
+void grad2d_vector(int hash, float* gx, float* gy) {
+    const int h = hash & 0x3F;
+    const float su = (h & 1) ? -1.0f : 1.0f;
+    const float sv = (h & 2) ? -2.0f : 2.0f;
+    *gx = h < 4 ? su : sv;
+    *gy = h < 4 ? sv : su;
+}
+
 float grad3d(int hash, float x, float y, float z) {
     int h = hash & 15;     // Convert low 4 bits of hash code into 12 simple
     float u = h < 8 ? x : y; // gradient directions, and compute dot product.
@@ -55,14 +101,14 @@ float grad3d(int hash, float x, float y, float z) {
     return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
 }
 
-float noise1d(float x) {
+float noise1d_ctx(const NoiseContext* ctx, float x) {
     float n0, n1;   // Noise contributions from the two "corners"
 
     // No need to skew the input space in 1D
 
     // Corners coordinates (nearest integer values):
     int i0 = fastfloor(x);
-    int i1 = i0 + 1;
+    const int ii = i0 & 255;
     // Distances to corners (between 0 and 1):
     float x0 = x - i0;
     float x1 = x0 - 1.0f;
@@ -71,20 +117,20 @@ float noise1d(float x) {
     float t0 = 1.0f - x0*x0;
 //  if(t0 < 0.0f) t0 = 0.0f; // not possible
     t0 *= t0;
-    n0 = t0 * t0 * grad1d(hash(i0), x0);
+    n0 = t0 * t0 * grad1d(ctx->perm[ii], x0);
 
     // Calculate the contribution from the second corner
     float t1 = 1.0f - x1*x1;
 //  if(t1 < 0.0f) t1 = 0.0f; // not possible
     t1 *= t1;
-    n1 = t1 * t1 * grad1d(hash(i1), x1);
+    n1 = t1 * t1 * grad1d(ctx->perm[ii + 1], x1);
 
     // The maximum value of this noise is 8*(3/4)^4 = 2.53125
     // A factor of 0.395 scales to fit exactly within [-1,1]
     return 0.395f * (n0 + n1);
 }
 
-float noise2d(float x, float y) {
+float noise2d_ctx(const NoiseContext* ctx, float x, float y) {
     float n0, n1, n2;   // Noise contributions from the three corners
 
     // Skewing/Unskewing factors for 2D
@@ -126,9 +172,12 @@ float noise2d(float x, float y) {
     const float y2 = y0 - 1.0f + 2.0f * G2;
 
     // Work out the hashed gradient indices of the three simplex corners
-    const int gi0 = hash(i + hash(j));
-    const int gi1 = hash(i + i1 + hash(j + j1));
-    const int gi2 = hash(i + 1 + hash(j + 1));
+    const int* p = ctx->perm;
+    const int ii = i & 255;
+    const int jj = j & 255;
+    const int gi0 = p[ii + p[jj]];
+    const int gi1 = p[ii + i1 + p[jj + j1]];
+    const int gi2 = p[ii + 1 + p[jj + 1]];
 
     // Calculate the contribution from the first corner
     float t0 = 0.5f - x0*x0 - y0*y0;
@@ -162,7 +211,7 @@ float noise2d(float x, float y) {
     return 45.23065f * (n0 + n1 + n2);
 }
 
-float noise3d(float x, float y, float z) {
+float noise3d_ctx(const NoiseContext* ctx, float x, float y, float z) {
     float n0, n1, n2, n3; // Noise contributions from the four corners
 
     // Skewing/Unskewing factors for 3D
@@ -219,10 +268,14 @@ float noise3d(float x, float y, float z) {
     float z3 = z0 - 1.0f + 3.0f * G3;
 
     // Work out the hashed gradient indices of the four simplex corners
-    int gi0 = hash(i + hash(j + hash(k)));
-    int gi1 = hash(i + i1 + hash(j + j1 + hash(k + k1)));
-    int gi2 = hash(i + i2 + hash(j + j2 + hash(k + k2)));
-    int gi3 = hash(i + 1 + hash(j + 1 + hash(k + 1)));
+    const int* p = ctx->perm;
+    const int ii = i & 255;
+    const int jj = j & 255;
+    const int kk = k & 255;
+    int gi0 = p[ii + p[jj + p[kk]]];
+    int gi1 = p[ii + i1 + p[jj + j1 + p[kk + k1]]];
+    int gi2 = p[ii + i2 + p[jj + j2 + p[kk + k2]]];
+    int gi3 = p[ii + 1 + p[jj + 1 + p[kk + 1]]];
 
     // Calculate the contribution from the four corners
     float t0 = 0.6f - x0*x0 - y0*y0 - z0*z0;
@@ -258,12 +311,534 @@ float noise3d(float x, float y, float z) {
     return 32.0f*(n0 + n1 + n2 + n3);
 }
 
-float fractal1d(float x, int octaves, float freq, float amp, float lacunarity, float persistence) {
+float noise1d(float x) {
+    return noise1d_ctx(&noise_default_context, x);
+}
+
+float noise2d(float x, float y) {
+    return noise2d_ctx(&noise_default_context, x, y);
+}
+
+float noise3d(float x, float y, float z) {
+    return noise3d_ctx(&noise_default_context, x, y, z);
+}
+
+// noise2d() plus its analytic partial derivatives, written to dx and dy. Each corner contributes
+// t^4 * (g . d) with t = 0.5 - |d|^2, whose derivative is t^4 * g - 8 * t^3 * (g . d) * d. The
+// returned value is bit-identical to noise2d().
+float noise2d_deriv_ctx(const NoiseContext* ctx, float x, float y, float* dx, float* dy) {
+    static const float F2 = 0.366025403f;
+    static const float G2 = 0.211324865f;
+
+    const float s = (x + y) * F2;
+    const int i = fastfloor(x + s);
+    const int j = fastfloor(y + s);
+
+    const float t = (float)(i + j) * G2;
+    const float x0 = x - (i - t);
+    const float y0 = y - (j - t);
+
+    const int i1 = x0 > y0 ? 1 : 0;
+    const int j1 = 1 - i1;
+
+    const float cx[3] = { x0, x0 - i1 + G2, x0 - 1.0f + 2.0f * G2 };
+    const float cy[3] = { y0, y0 - j1 + G2, y0 - 1.0f + 2.0f * G2 };
+
+    const int* p = ctx->perm;
+    const int ii = i & 255;
+    const int jj = j & 255;
+    const int gi[3] = { p[ii + p[jj]], p[ii + i1 + p[jj + j1]], p[ii + 1 + p[jj + 1]] };
+
+    float n[3] = { 0.0f, 0.0f, 0.0f };
+    float ddx = 0.0f;
+    float ddy = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        const float tc = 0.5f - cx[c]*cx[c] - cy[c]*cy[c];
+        if (tc < 0.0f)
+            continue;
+
+        float gx, gy;
+        grad2d_vector(gi[c], &gx, &gy);
+        const float gd = grad2d(gi[c], cx[c], cy[c]);
+        const float t2 = tc * tc;
+        const float t4 = t2 * t2;
+        n[c] = t4 * gd;
+
+        const float k = -8.0f * t2 * tc * gd;
+        ddx += t4 * gx + k * cx[c];
+        ddy += t4 * gy + k * cy[c];
+    }
+
+    *dx = 45.23065f * ddx;
+    *dy = 45.23065f * ddy;
+    return 45.23065f * (n[0] + n[1] + n[2]);
+}
+
+float noise2d_deriv(float x, float y, float* dx, float* dy) {
+    return noise2d_deriv_ctx(&noise_default_context, x, y, dx, dy);
+}
+
+// Batch evaluation
+//
+// noise2d_batch()/noise3d_batch() evaluate n samples stored as separate coordinate arrays. The SIMD
+// kernels run the exact same sequence of float operations as noise2d()/noise3d(), only with the
+// corner branches turned into masks and the perm[] lookups done per lane (SSE2) or with gathers
+// (AVX2), so the output is bit-identical to the scalar functions. The one exception is a build
+// where the compiler is allowed to contract the scalar code into FMAs (-mfma with the default
+// -ffp-contract=fast): the kernels never fuse, so results can then differ by a few ULP.
+//
+// The kernel is picked on first use from what the CPU supports; noise_set_batch_kernel() can force
+// a particular one (e.g. for comparing them). The *_ctx variants take the permutation context.
+
+typedef enum {
+    NOISE_BATCH_KERNEL_SCALAR,
+    NOISE_BATCH_KERNEL_SSE2,
+    NOISE_BATCH_KERNEL_AVX2,
+    _NOISE_BATCH_KERNEL_MAX
+} NoiseBatchKernel;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define NOISE_BATCH_X86
+#include <immintrin.h>
+#endif
+
+typedef void NoiseBatch2dFunc(const NoiseContext* ctx, const float* xs, const float* ys, float* out, int n);
+typedef void NoiseBatch3dFunc(const NoiseContext* ctx, const float* xs, const float* ys, const float* zs, float* out, int n);
+
+void noise2d_batch_scalar(const NoiseContext* ctx, const float* xs, const float* ys, float* out, int n) {
+    for (int i = 0; i < n; ++i)
+        out[i] = noise2d_ctx(ctx, xs[i], ys[i]);
+}
+
+void noise3d_batch_scalar(const NoiseContext* ctx, const float* xs, const float* ys, const float* zs, float* out, int n) {
+    for (int i = 0; i < n; ++i)
+        out[i] = noise3d_ctx(ctx, xs[i], ys[i], zs[i]);
+}
+
+#ifdef NOISE_BATCH_X86
+
+static inline __m128i noise_fastfloor_sse2(__m128 v) {
+    const __m128i i = _mm_cvttps_epi32(v);
+    const __m128i lt = _mm_castps_si128(_mm_cmplt_ps(v, _mm_cvtepi32_ps(i)));
+    return _mm_add_epi32(i, lt); // lt is -1 in the lanes that need rounding down
+}
+
+static inline __m128 noise_select_sse2(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); // mask ? a : b
+}
+
+static inline __m128 noise_grad2d_sse2(__m128i hash, __m128 x, __m128 y) {
+    const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(0x3F));
+    const __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    const __m128 u = noise_select_sse2(lt4, x, y);
+    const __m128 v = _mm_mul_ps(_mm_set1_ps(2.0f), noise_select_sse2(lt4, y, x));
+    // (h & 1) and (h & 2) become sign flips
+    const __m128 su = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    const __m128 sv = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, su), _mm_xor_ps(v, sv));
+}
+
+static inline __m128 noise_grad3d_sse2(__m128i hash, __m128 x, __m128 y, __m128 z) {
+    const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+    const __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+    const __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    const __m128 is12or14 = _mm_castsi128_ps(_mm_or_si128(
+        _mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+    const __m128 u = noise_select_sse2(lt8, x, y);
+    const __m128 v = noise_select_sse2(lt4, y, noise_select_sse2(is12or14, x, z));
+    const __m128 su = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    const __m128 sv = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, su), _mm_xor_ps(v, sv));
+}
+
+static inline __m128 noise_contrib2d_sse2(__m128i hash, __m128 x, __m128 y) {
+    __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y));
+    const __m128 inside = _mm_cmpnlt_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    return _mm_and_ps(inside, _mm_mul_ps(_mm_mul_ps(t, t), noise_grad2d_sse2(hash, x, y)));
+}
+
+static inline __m128 noise_contrib3d_sse2(__m128i hash, __m128 x, __m128 y, __m128 z) {
+    __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.6f),
+        _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    const __m128 inside = _mm_cmpnlt_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    return _mm_and_ps(inside, _mm_mul_ps(_mm_mul_ps(t, t), noise_grad3d_sse2(hash, x, y, z)));
+}
+
+void noise2d_batch_sse2(const NoiseContext* ctx, const float* xs, const float* ys, float* out, int n) {
+    static const float F2 = 0.366025403f;
+    static const float G2 = 0.211324865f;
+
+    const __m128i one = _mm_set1_epi32(1);
+    int b = 0;
+    for (; b + 4 <= n; b += 4) {
+        const __m128 x = _mm_loadu_ps(xs + b);
+        const __m128 y = _mm_loadu_ps(ys + b);
+
+        const __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+        const __m128i i = noise_fastfloor_sse2(_mm_add_ps(x, s));
+        const __m128i j = noise_fastfloor_sse2(_mm_add_ps(y, s));
+
+        const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), _mm_set1_ps(G2));
+        const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+        const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+
+        // Lower triangle where x0 > y0: (i1, j1) is (1, 0), otherwise (0, 1)
+        const __m128i lower = _mm_castps_si128(_mm_cmpgt_ps(x0, y0));
+        const __m128i i1 = _mm_and_si128(lower, one);
+        const __m128i j1 = _mm_andnot_si128(lower, one);
+
+        const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i1)), _mm_set1_ps(G2));
+        const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j1)), _mm_set1_ps(G2));
+        const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_set1_ps(1.0f)), _mm_set1_ps(2.0f * G2));
+        const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_set1_ps(1.0f)), _mm_set1_ps(2.0f * G2));
+
+        // SSE2 has no gather, so the hashes are looked up lane by lane
+        int il[4], jl[4], i1l[4], j1l[4], g[3][4];
+        _mm_storeu_si128((__m128i*)il, i);
+        _mm_storeu_si128((__m128i*)jl, j);
+        _mm_storeu_si128((__m128i*)i1l, i1);
+        _mm_storeu_si128((__m128i*)j1l, j1);
+        const int* p = ctx->perm;
+        for (int l = 0; l < 4; ++l) {
+            const int ii = il[l] & 255;
+            const int jj = jl[l] & 255;
+            g[0][l] = p[ii + p[jj]];
+            g[1][l] = p[ii + i1l[l] + p[jj + j1l[l]]];
+            g[2][l] = p[ii + 1 + p[jj + 1]];
+        }
+
+        const __m128 n0 = noise_contrib2d_sse2(_mm_loadu_si128((const __m128i*)g[0]), x0, y0);
+        const __m128 n1 = noise_contrib2d_sse2(_mm_loadu_si128((const __m128i*)g[1]), x1, y1);
+        const __m128 n2 = noise_contrib2d_sse2(_mm_loadu_si128((const __m128i*)g[2]), x2, y2);
+
+        _mm_storeu_ps(out + b, _mm_mul_ps(_mm_set1_ps(45.23065f), _mm_add_ps(_mm_add_ps(n0, n1), n2)));
+    }
+
+    noise2d_batch_scalar(ctx, xs + b, ys + b, out + b, n - b);
+}
+
+void noise3d_batch_sse2(const NoiseContext* ctx, const float* xs, const float* ys, const float* zs, float* out, int n) {
+    static const float F3 = 1.0f / 3.0f;
+    static const float G3 = 1.0f / 6.0f;
+
+    const __m128i one = _mm_set1_epi32(1);
+    int b = 0;
+    for (; b + 4 <= n; b += 4) {
+        const __m128 x = _mm_loadu_ps(xs + b);
+        const __m128 y = _mm_loadu_ps(ys + b);
+        const __m128 z = _mm_loadu_ps(zs + b);
+
+        const __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), _mm_set1_ps(F3));
+        const __m128i i = noise_fastfloor_sse2(_mm_add_ps(x, s));
+        const __m128i j = noise_fastfloor_sse2(_mm_add_ps(y, s));
+        const __m128i k = noise_fastfloor_sse2(_mm_add_ps(z, s));
+
+        const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_add_epi32(i, j), k)), _mm_set1_ps(G3));
+        const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+        const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+        const __m128 z0 = _mm_sub_ps(z, _mm_sub_ps(_mm_cvtepi32_ps(k), t));
+
+        // The six-way simplex ordering of noise3d() written as masks
+        const __m128i xy = _mm_castps_si128(_mm_cmpge_ps(x0, y0));
+        const __m128i yz = _mm_castps_si128(_mm_cmpge_ps(y0, z0));
+        const __m128i xz = _mm_castps_si128(_mm_cmpge_ps(x0, z0));
+        const __m128i m_i1 = _mm_and_si128(xy, xz);
+        const __m128i m_j1 = _mm_andnot_si128(xy, yz);
+        const __m128i m_i2 = _mm_or_si128(xy, xz);
+        const __m128i m_j2 = _mm_or_si128(_mm_andnot_si128(xy, _mm_set1_epi32(-1)), yz);
+        const __m128i m_k2 = _mm_andnot_si128(_mm_and_si128(xz, yz), _mm_set1_epi32(-1));
+        const __m128i i1 = _mm_and_si128(m_i1, one);
+        const __m128i j1 = _mm_and_si128(m_j1, one);
+        const __m128i k1 = _mm_andnot_si128(_mm_or_si128(m_i1, m_j1), one);
+        const __m128i i2 = _mm_and_si128(m_i2, one);
+        const __m128i j2 = _mm_and_si128(m_j2, one);
+        const __m128i k2 = _mm_and_si128(m_k2, one);
+
+        const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i1)), _mm_set1_ps(G3));
+        const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j1)), _mm_set1_ps(G3));
+        const __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_cvtepi32_ps(k1)), _mm_set1_ps(G3));
+        const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i2)), _mm_set1_ps(2.0f * G3));
+        const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j2)), _mm_set1_ps(2.0f * G3));
+        const __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, _mm_cvtepi32_ps(k2)), _mm_set1_ps(2.0f * G3));
+        const __m128 x3 = _mm_add_ps(_mm_sub_ps(x0, _mm_set1_ps(1.0f)), _mm_set1_ps(3.0f * G3));
+        const __m128 y3 = _mm_add_ps(_mm_sub_ps(y0, _mm_set1_ps(1.0f)), _mm_set1_ps(3.0f * G3));
+        const __m128 z3 = _mm_add_ps(_mm_sub_ps(z0, _mm_set1_ps(1.0f)), _mm_set1_ps(3.0f * G3));
+
+        int il[4], jl[4], kl[4], o1[3][4], o2[3][4], g[4][4];
+        _mm_storeu_si128((__m128i*)il, i);
+        _mm_storeu_si128((__m128i*)jl, j);
+        _mm_storeu_si128((__m128i*)kl, k);
+        _mm_storeu_si128((__m128i*)o1[0], i1);
+        _mm_storeu_si128((__m128i*)o1[1], j1);
+        _mm_storeu_si128((__m128i*)o1[2], k1);
+        _mm_storeu_si128((__m128i*)o2[0], i2);
+        _mm_storeu_si128((__m128i*)o2[1], j2);
+        _mm_storeu_si128((__m128i*)o2[2], k2);
+        const int* p = ctx->perm;
+        for (int l = 0; l < 4; ++l) {
+            const int ii = il[l] & 255;
+            const int jj = jl[l] & 255;
+            const int kk = kl[l] & 255;
+            g[0][l] = p[ii + p[jj + p[kk]]];
+            g[1][l] = p[ii + o1[0][l] + p[jj + o1[1][l] + p[kk + o1[2][l]]]];
+            g[2][l] = p[ii + o2[0][l] + p[jj + o2[1][l] + p[kk + o2[2][l]]]];
+            g[3][l] = p[ii + 1 + p[jj + 1 + p[kk + 1]]];
+        }
+
+        const __m128 n0 = noise_contrib3d_sse2(_mm_loadu_si128((const __m128i*)g[0]), x0, y0, z0);
+        const __m128 n1 = noise_contrib3d_sse2(_mm_loadu_si128((const __m128i*)g[1]), x1, y1, z1);
+        const __m128 n2 = noise_contrib3d_sse2(_mm_loadu_si128((const __m128i*)g[2]), x2, y2, z2);
+        const __m128 n3 = noise_contrib3d_sse2(_mm_loadu_si128((const __m128i*)g[3]), x3, y3, z3);
+
+        _mm_storeu_ps(out + b, _mm_mul_ps(_mm_set1_ps(32.0f),
+            _mm_add_ps(_mm_add_ps(_mm_add_ps(n0, n1), n2), n3)));
+    }
+
+    noise3d_batch_scalar(ctx, xs + b, ys + b, zs + b, out + b, n - b);
+}
+
+#define NOISE_AVX2 __attribute__((target("avx2")))
+
+NOISE_AVX2 static inline __m256i noise_fastfloor_avx2(__m256 v) {
+    const __m256i i = _mm256_cvttps_epi32(v);
+    const __m256i lt = _mm256_castps_si256(_mm256_cmp_ps(v, _mm256_cvtepi32_ps(i), _CMP_LT_OQ));
+    return _mm256_add_epi32(i, lt);
+}
+
+// Indices are at most 255 + 256, which the doubled table covers without masking
+NOISE_AVX2 static inline __m256i noise_hash_avx2(const int* perm, __m256i i) {
+    return _mm256_i32gather_epi32(perm, i, 4);
+}
+
+NOISE_AVX2 static inline __m256 noise_grad2d_avx2(__m256i hash, __m256 x, __m256 y) {
+    const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(0x3F));
+    const __m256 lt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    const __m256 u = _mm256_blendv_ps(y, x, lt4);
+    const __m256 v = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_blendv_ps(x, y, lt4));
+    const __m256 su = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    const __m256 sv = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, su), _mm256_xor_ps(v, sv));
+}
+
+NOISE_AVX2 static inline __m256 noise_grad3d_avx2(__m256i hash, __m256 x, __m256 y, __m256 z) {
+    const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+    const __m256 lt8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+    const __m256 lt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    const __m256 is12or14 = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+    const __m256 u = _mm256_blendv_ps(y, x, lt8);
+    const __m256 v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, is12or14), y, lt4);
+    const __m256 su = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    const __m256 sv = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, su), _mm256_xor_ps(v, sv));
+}
+
+NOISE_AVX2 static inline __m256 noise_contrib2d_avx2(__m256i hash, __m256 x, __m256 y) {
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y));
+    const __m256 inside = _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_NLT_UQ);
+    t = _mm256_mul_ps(t, t);
+    return _mm256_and_ps(inside, _mm256_mul_ps(_mm256_mul_ps(t, t), noise_grad2d_avx2(hash, x, y)));
+}
+
+NOISE_AVX2 static inline __m256 noise_contrib3d_avx2(__m256i hash, __m256 x, __m256 y, __m256 z) {
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(0.6f),
+        _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+    const __m256 inside = _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_NLT_UQ);
+    t = _mm256_mul_ps(t, t);
+    return _mm256_and_ps(inside, _mm256_mul_ps(_mm256_mul_ps(t, t), noise_grad3d_avx2(hash, x, y, z)));
+}
+
+NOISE_AVX2 void noise2d_batch_avx2(const NoiseContext* ctx, const float* xs, const float* ys, float* out, int n) {
+    static const float F2 = 0.366025403f;
+    static const float G2 = 0.211324865f;
+
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i mask = _mm256_set1_epi32(255);
+    int b = 0;
+    for (; b + 8 <= n; b += 8) {
+        const __m256 x = _mm256_loadu_ps(xs + b);
+        const __m256 y = _mm256_loadu_ps(ys + b);
+
+        const __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(F2));
+        const __m256i i = noise_fastfloor_avx2(_mm256_add_ps(x, s));
+        const __m256i j = noise_fastfloor_avx2(_mm256_add_ps(y, s));
+
+        const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(i, j)), _mm256_set1_ps(G2));
+        const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+        const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+
+        const __m256i lower = _mm256_castps_si256(_mm256_cmp_ps(x0, y0, _CMP_GT_OQ));
+        const __m256i i1 = _mm256_and_si256(lower, one);
+        const __m256i j1 = _mm256_andnot_si256(lower, one);
+
+        const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_cvtepi32_ps(i1)), _mm256_set1_ps(G2));
+        const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_cvtepi32_ps(j1)), _mm256_set1_ps(G2));
+        const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(2.0f * G2));
+        const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(2.0f * G2));
+
+        const int* p = ctx->perm;
+        const __m256i ii = _mm256_and_si256(i, mask);
+        const __m256i jj = _mm256_and_si256(j, mask);
+        const __m256i g0 = noise_hash_avx2(p, _mm256_add_epi32(ii, noise_hash_avx2(p, jj)));
+        const __m256i g1 = noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(ii, i1),
+            noise_hash_avx2(p, _mm256_add_epi32(jj, j1))));
+        const __m256i g2 = noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(ii, one),
+            noise_hash_avx2(p, _mm256_add_epi32(jj, one))));
+
+        const __m256 n0 = noise_contrib2d_avx2(g0, x0, y0);
+        const __m256 n1 = noise_contrib2d_avx2(g1, x1, y1);
+        const __m256 n2 = noise_contrib2d_avx2(g2, x2, y2);
+
+        _mm256_storeu_ps(out + b, _mm256_mul_ps(_mm256_set1_ps(45.23065f),
+            _mm256_add_ps(_mm256_add_ps(n0, n1), n2)));
+    }
+
+    noise2d_batch_scalar(ctx, xs + b, ys + b, out + b, n - b);
+}
+
+NOISE_AVX2 void noise3d_batch_avx2(const NoiseContext* ctx, const float* xs, const float* ys, const float* zs, float* out, int n) {
+    static const float F3 = 1.0f / 3.0f;
+    static const float G3 = 1.0f / 6.0f;
+
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i all = _mm256_set1_epi32(-1);
+    int b = 0;
+    for (; b + 8 <= n; b += 8) {
+        const __m256 x = _mm256_loadu_ps(xs + b);
+        const __m256 y = _mm256_loadu_ps(ys + b);
+        const __m256 z = _mm256_loadu_ps(zs + b);
+
+        const __m256 s = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(x, y), z), _mm256_set1_ps(F3));
+        const __m256i i = noise_fastfloor_avx2(_mm256_add_ps(x, s));
+        const __m256i j = noise_fastfloor_avx2(_mm256_add_ps(y, s));
+        const __m256i k = noise_fastfloor_avx2(_mm256_add_ps(z, s));
+
+        const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_add_epi32(i, j), k)),
+            _mm256_set1_ps(G3));
+        const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+        const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+        const __m256 z0 = _mm256_sub_ps(z, _mm256_sub_ps(_mm256_cvtepi32_ps(k), t));
+
+        const __m256i xy = _mm256_castps_si256(_mm256_cmp_ps(x0, y0, _CMP_GE_OQ));
+        const __m256i yz = _mm256_castps_si256(_mm256_cmp_ps(y0, z0, _CMP_GE_OQ));
+        const __m256i xz = _mm256_castps_si256(_mm256_cmp_ps(x0, z0, _CMP_GE_OQ));
+        const __m256i m_i1 = _mm256_and_si256(xy, xz);
+        const __m256i m_j1 = _mm256_andnot_si256(xy, yz);
+        const __m256i i1 = _mm256_and_si256(m_i1, one);
+        const __m256i j1 = _mm256_and_si256(m_j1, one);
+        const __m256i k1 = _mm256_andnot_si256(_mm256_or_si256(m_i1, m_j1), one);
+        const __m256i i2 = _mm256_and_si256(_mm256_or_si256(xy, xz), one);
+        const __m256i j2 = _mm256_and_si256(_mm256_or_si256(_mm256_andnot_si256(xy, all), yz), one);
+        const __m256i k2 = _mm256_andnot_si256(_mm256_and_si256(xz, yz), one);
+
+        const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_cvtepi32_ps(i1)), _mm256_set1_ps(G3));
+        const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_cvtepi32_ps(j1)), _mm256_set1_ps(G3));
+        const __m256 z1 = _mm256_add_ps(_mm256_sub_ps(z0, _mm256_cvtepi32_ps(k1)), _mm256_set1_ps(G3));
+        const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_cvtepi32_ps(i2)), _mm256_set1_ps(2.0f * G3));
+        const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_cvtepi32_ps(j2)), _mm256_set1_ps(2.0f * G3));
+        const __m256 z2 = _mm256_add_ps(_mm256_sub_ps(z0, _mm256_cvtepi32_ps(k2)), _mm256_set1_ps(2.0f * G3));
+        const __m256 x3 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(3.0f * G3));
+        const __m256 y3 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(3.0f * G3));
+        const __m256 z3 = _mm256_add_ps(_mm256_sub_ps(z0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(3.0f * G3));
+
+        const int* p = ctx->perm;
+        const __m256i ii = _mm256_and_si256(i, mask);
+        const __m256i jj = _mm256_and_si256(j, mask);
+        const __m256i kk = _mm256_and_si256(k, mask);
+        const __m256i g0 = noise_hash_avx2(p, _mm256_add_epi32(ii,
+            noise_hash_avx2(p, _mm256_add_epi32(jj, noise_hash_avx2(p, kk)))));
+        const __m256i g1 = noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(ii, i1),
+            noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(jj, j1),
+            noise_hash_avx2(p, _mm256_add_epi32(kk, k1))))));
+        const __m256i g2 = noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(ii, i2),
+            noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(jj, j2),
+            noise_hash_avx2(p, _mm256_add_epi32(kk, k2))))));
+        const __m256i g3 = noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(ii, one),
+            noise_hash_avx2(p, _mm256_add_epi32(_mm256_add_epi32(jj, one),
+            noise_hash_avx2(p, _mm256_add_epi32(kk, one))))));
+
+        const __m256 n0 = noise_contrib3d_avx2(g0, x0, y0, z0);
+        const __m256 n1 = noise_contrib3d_avx2(g1, x1, y1, z1);
+        const __m256 n2 = noise_contrib3d_avx2(g2, x2, y2, z2);
+        const __m256 n3 = noise_contrib3d_avx2(g3, x3, y3, z3);
+
+        _mm256_storeu_ps(out + b, _mm256_mul_ps(_mm256_set1_ps(32.0f),
+            _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(n0, n1), n2), n3)));
+    }
+
+    noise3d_batch_scalar(ctx, xs + b, ys + b, zs + b, out + b, n - b);
+}
+
+#endif // NOISE_BATCH_X86
+
+NoiseBatchKernel noise_batch_kernel = _NOISE_BATCH_KERNEL_MAX;
+NoiseBatch2dFunc* noise2d_batch_func = noise2d_batch_scalar;
+NoiseBatch3dFunc* noise3d_batch_func = noise3d_batch_scalar;
+
+// Returns the kernel actually in use, which falls back to the best supported one
+NoiseBatchKernel noise_set_batch_kernel(NoiseBatchKernel kernel) {
+#ifdef NOISE_BATCH_X86
+    if (kernel == NOISE_BATCH_KERNEL_AVX2 && !__builtin_cpu_supports("avx2"))
+        kernel = NOISE_BATCH_KERNEL_SSE2;
+#else
+    kernel = NOISE_BATCH_KERNEL_SCALAR;
+#endif
+
+    switch (kernel) {
+#ifdef NOISE_BATCH_X86
+        case NOISE_BATCH_KERNEL_AVX2:
+            noise2d_batch_func = noise2d_batch_avx2;
+            noise3d_batch_func = noise3d_batch_avx2;
+            break;
+        case NOISE_BATCH_KERNEL_SSE2:
+            noise2d_batch_func = noise2d_batch_sse2;
+            noise3d_batch_func = noise3d_batch_sse2;
+            break;
+#endif
+        default:
+            kernel = NOISE_BATCH_KERNEL_SCALAR;
+            noise2d_batch_func = noise2d_batch_scalar;
+            noise3d_batch_func = noise3d_batch_scalar;
+            break;
+    }
+
+    noise_batch_kernel = kernel;
+    return kernel;
+}
+
+NoiseBatchKernel noise_get_batch_kernel() {
+    if (noise_batch_kernel == _NOISE_BATCH_KERNEL_MAX)
+        noise_set_batch_kernel(NOISE_BATCH_KERNEL_AVX2);
+    return noise_batch_kernel;
+}
+
+void noise2d_batch_ctx(const NoiseContext* ctx, const float* xs, const float* ys, float* out, int n) {
+    noise_get_batch_kernel();
+    noise2d_batch_func(ctx, xs, ys, out, n);
+}
+
+void noise3d_batch_ctx(const NoiseContext* ctx, const float* xs, const float* ys, const float* zs, float* out, int n) {
+    noise_get_batch_kernel();
+    noise3d_batch_func(ctx, xs, ys, zs, out, n);
+}
+
+void noise2d_batch(const float* xs, const float* ys, float* out, int n) {
+    noise2d_batch_ctx(&noise_default_context, xs, ys, out, n);
+}
+
+void noise3d_batch(const float* xs, const float* ys, const float* zs, float* out, int n) {
+    noise3d_batch_ctx(&noise_default_context, xs, ys, zs, out, n);
+}
+
+float fractal1d_ctx(const NoiseContext* ctx, float x, int octaves, float freq, float amp, float lacunarity, float persistence) {
     float output    = 0.f;
     float denom     = 0.f;
 
     for (int i = 0; i < octaves; i++) {
-        output += (amp * noise1d(x * freq));
+        output += (amp * noise1d_ctx(ctx, x * freq));
         denom += amp;
 
         freq *= lacunarity;
@@ -273,12 +848,12 @@ float fractal1d(float x, int octaves, float freq, float amp, float lacunarity, f
     return (output / denom);
 }
 
-float fractal2d(float x, float y, int octaves, float freq, float amp, float lacunarity, float persistence) {
+float fractal2d_ctx(const NoiseContext* ctx, float x, float y, int octaves, float freq, float amp, float lacunarity, float persistence) {
     float output = 0.f;
     float denom  = 0.f;
 
     for (int i = 0; i < octaves; i++) {
-        output += (amp * noise2d(x * freq, y * freq));
+        output += (amp * noise2d_ctx(ctx, x * freq, y * freq));
         denom += amp;
 
         freq *= lacunarity;
@@ -288,19 +863,182 @@ float fractal2d(float x, float y, int octaves, float freq, float amp, float lacu
     return (output / denom);
 }
 
+float fractal3d_ctx(const NoiseContext* ctx, float x, float y, float z, int octaves, float freq, float amp, float lacunarity, float persistence) {
+    float output = 0.f;
+    float denom  = 0.f;
+
+    for (int i = 0; i < octaves; i++) {
+        output += (amp * noise3d_ctx(ctx, x * freq, y * freq, z * freq));
+        denom += amp;
+
+        freq *= lacunarity;
+        amp *= persistence;
+    }
+
+    return (output / denom);
+}
+
+float fractal1d(float x, int octaves, float freq, float amp, float lacunarity, float persistence) {
+    return fractal1d_ctx(&noise_default_context, x, octaves, freq, amp, lacunarity, persistence);
+}
+
+float fractal2d(float x, float y, int octaves, float freq, float amp, float lacunarity, float persistence) {
+    return fractal2d_ctx(&noise_default_context, x, y, octaves, freq, amp, lacunarity, persistence);
+}
+
 float fractal3d(float x, float y, float z, int octaves, float freq, float amp, float lacunarity, float persistence) {
+    return fractal3d_ctx(&noise_default_context, x, y, z, octaves, freq, amp, lacunarity, persistence);
+}
+
+// fractal2d() plus its partial derivatives with respect to x and y
+float fractal2d_deriv_ctx(const NoiseContext* ctx, float x, float y, int octaves, float freq, float amp,
+    float lacunarity, float persistence, float* dx, float* dy) {
     float output = 0.f;
     float denom  = 0.f;
+    float ddx    = 0.f;
+    float ddy    = 0.f;
 
     for (int i = 0; i < octaves; i++) {
-        output += (amp * noise3d(x * freq, y * freq, z * freq));
+        float nx, ny;
+        output += (amp * noise2d_deriv_ctx(ctx, x * freq, y * freq, &nx, &ny));
+        ddx += (amp * freq * nx);
+        ddy += (amp * freq * ny);
         denom += amp;
 
         freq *= lacunarity;
         amp *= persistence;
     }
 
+    *dx = ddx / denom;
+    *dy = ddy / denom;
     return (output / denom);
 }
 
+float fractal2d_deriv(float x, float y, int octaves, float freq, float amp, float lacunarity, float persistence,
+    float* dx, float* dy) {
+    return fractal2d_deriv_ctx(&noise_default_context, x, y, octaves, freq, amp, lacunarity, persistence, dx, dy);
+}
+
+// Fills a w * h grid (row-major, out[row * w + col]) with fractal2d() sampled at
+// (x0 + col * step, y0 + row * step). The octave amplitudes and their sum are computed once for the
+// whole grid, and so are the scaled column coordinates of every octave, so walking a row only
+// copies coordinates instead of multiplying them. Each row runs through all octaves (via
+// noise2d_batch) before moving on, which keeps it in L1. The per-sample operations are the same as
+// in fractal2d(), so the output is bit-identical to calling it for each point.
+void fractal2d_grid_ctx(const NoiseContext* ctx, float* out, int w, int h, float x0, float y0, float step,
+    int octaves, float freq, float amp, float lacunarity, float persistence) {
+    float* octaveFreqs = (float*)malloc(sizeof(float) * octaves * 2);
+    float* octaveAmps = octaveFreqs + octaves;
+    float denom = 0.f;
+    for (int i = 0; i < octaves; i++) {
+        octaveFreqs[i] = freq;
+        octaveAmps[i] = amp;
+        denom += amp;
+
+        freq *= lacunarity;
+        amp *= persistence;
+    }
+
+    float* xs = (float*)malloc(sizeof(float) * w * (octaves + 2));
+    float* ys = xs + w * octaves;
+    float* ns = ys + w;
+
+    for (int col = 0; col < w; col++) {
+        const float x = x0 + col * step;
+        for (int i = 0; i < octaves; i++)
+            xs[i * w + col] = x * octaveFreqs[i];
+    }
+
+    for (int row = 0; row < h; row++) {
+        const float y = y0 + row * step;
+        float* outRow = out + row * w;
+        for (int col = 0; col < w; col++)
+            outRow[col] = 0.f;
+
+        for (int i = 0; i < octaves; i++) {
+            const float yf = y * octaveFreqs[i];
+            for (int col = 0; col < w; col++)
+                ys[col] = yf;
+
+            noise2d_batch_ctx(ctx, xs + i * w, ys, ns, w);
+
+            const float octaveAmp = octaveAmps[i];
+            for (int col = 0; col < w; col++)
+                outRow[col] += octaveAmp * ns[col];
+        }
+
+        for (int col = 0; col < w; col++)
+            outRow[col] /= denom;
+    }
+
+    free(xs);
+    free(octaveFreqs);
+}
+
+void fractal2d_grid(float* out, int w, int h, float x0, float y0, float step,
+    int octaves, float freq, float amp, float lacunarity, float persistence) {
+    fractal2d_grid_ctx(&noise_default_context, out, w, h, x0, y0, step, octaves, freq, amp, lacunarity, persistence);
+}
+
+// fractal2d_grid() that also writes the x and y partial derivatives of every sample to outDx and
+// outDy, laid out like out. Same row-coherent walk, but through the scalar noise2d_deriv_ctx().
+void fractal2d_deriv_grid_ctx(const NoiseContext* ctx, float* out, float* outDx, float* outDy, int w, int h,
+    float x0, float y0, float step, int octaves, float freq, float amp, float lacunarity, float persistence) {
+    float* octaveFreqs = (float*)malloc(sizeof(float) * octaves * 2);
+    float* octaveAmps = octaveFreqs + octaves;
+    float denom = 0.f;
+    for (int i = 0; i < octaves; i++) {
+        octaveFreqs[i] = freq;
+        octaveAmps[i] = amp;
+        denom += amp;
+
+        freq *= lacunarity;
+        amp *= persistence;
+    }
+
+    float* xs = (float*)malloc(sizeof(float) * w * octaves);
+    for (int col = 0; col < w; col++) {
+        const float x = x0 + col * step;
+        for (int i = 0; i < octaves; i++)
+            xs[i * w + col] = x * octaveFreqs[i];
+    }
+
+    for (int row = 0; row < h; row++) {
+        const float y = y0 + row * step;
+        float* outRow = out + row * w;
+        float* dxRow = outDx + row * w;
+        float* dyRow = outDy + row * w;
+        for (int col = 0; col < w; col++)
+            outRow[col] = dxRow[col] = dyRow[col] = 0.f;
+
+        for (int i = 0; i < octaves; i++) {
+            const float yf = y * octaveFreqs[i];
+            const float octaveAmp = octaveAmps[i];
+            const float derivScale = octaveAmp * octaveFreqs[i];
+            const float* xsOctave = xs + i * w;
+            for (int col = 0; col < w; col++) {
+                float nx, ny;
+                outRow[col] += octaveAmp * noise2d_deriv_ctx(ctx, xsOctave[col], yf, &nx, &ny);
+                dxRow[col] += derivScale * nx;
+                dyRow[col] += derivScale * ny;
+            }
+        }
+
+        for (int col = 0; col < w; col++) {
+            outRow[col] /= denom;
+            dxRow[col] /= denom;
+            dyRow[col] /= denom;
+        }
+    }
+
+    free(xs);
+    free(octaveFreqs);
+}
+
+void fractal2d_deriv_grid(float* out, float* outDx, float* outDy, int w, int h, float x0, float y0, float step,
+    int octaves, float freq, float amp, float lacunarity, float persistence) {
+    fractal2d_deriv_grid_ctx(&noise_default_context, out, outDx, outDy, w, h, x0, y0, step,
+        octaves, freq, amp, lacunarity, persistence);
+}
+
 #endif
\ No newline at end of file
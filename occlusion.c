@@ -0,0 +1,186 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "macromagic.h"
+#include "occlusion.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE__)
+#define OCCLUSION_SIMD_X86
+#include <immintrin.h>
+#endif
+
+void occlusion_init(OcclusionBuffer* out)
+{
+    out->depths = (float*)malloc(sizeof(float) * OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT);
+    for (int i = 0; i < 16; ++i)
+        out->clip[i] = i % 5 == 0 ? 1.0f : 0.0f;
+}
+
+void occlusion_destroy(OcclusionBuffer* buffer)
+{
+    free(buffer->depths);
+    buffer->depths = NULL;
+}
+
+void occlusion_clear(OcclusionBuffer* buffer, const float* clip)
+{
+    for (int i = 0; i < 16; ++i)
+        buffer->clip[i] = clip[i];
+    for (int i = 0; i < OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT; ++i)
+        buffer->depths[i] = FLT_MAX;
+}
+
+// Writes the point's buffer coordinates and 1 / view depth, returns FALSE if it is too near to project
+int project_point(const float* clip, const float* p, float* out)
+{
+    const float x = clip[0] * p[0] + clip[4] * p[1] + clip[8] * p[2] + clip[12];
+    const float y = clip[1] * p[0] + clip[5] * p[1] + clip[9] * p[2] + clip[13];
+    const float w = clip[3] * p[0] + clip[7] * p[1] + clip[11] * p[2] + clip[15];
+    if (w < OCCLUSION_MIN_DEPTH)
+        return FALSE;
+
+    const float invW = 1.0f / w;
+    out[0] = (x * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+    out[1] = (y * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+    out[2] = invW;
+    return TRUE;
+}
+
+// Projected points near the camera can land far outside the buffer, so clamp before converting
+int clamp_to_buffer(float coord, int size)
+{
+    return coord < 0.0f ? 0 : (coord > (float)size ? size : (int)coord);
+}
+
+void occlusion_rasterise_quad(OcclusionBuffer* buffer, const float* corners)
+{
+    float v[4][3];
+    for (int i = 0; i < 4; ++i)
+        if (!project_point(buffer->clip, &corners[i * 3], v[i]))
+            return;
+
+    // Shoelace area, negative for quads facing away and near zero for those seen edge-on
+    float area = 0.0f;
+    for (int i = 0; i < 4; ++i)
+        area += v[i][0] * v[(i + 1) % 4][1] - v[(i + 1) % 4][0] * v[i][1];
+    if (area < 1e-3f)
+        return;
+
+    // Edge functions a * x + b * y + c, positive inside, offset to be evaluated at pixel centres
+    float ea[4], eb[4], ec[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        const float* v0 = v[i];
+        const float* v1 = v[(i + 1) % 4];
+        const float dx = v1[0] - v0[0];
+        const float dy = v1[1] - v0[1];
+        ea[i] = -dy;
+        eb[i] = dx;
+        ec[i] = dy * v0[0] - dx * v0[1] + 0.5f * (ea[i] + eb[i]);
+    }
+
+    // 1 / depth is affine in screen space across a planar polygon. Fit it through the three vertices
+    // spanning the larger triangle, and move it to the pixel corner where the quad is furthest away.
+    const int t = fabsf((v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1])) >=
+        fabsf((v[2][0] - v[0][0]) * (v[3][1] - v[0][1]) - (v[3][0] - v[0][0]) * (v[2][1] - v[0][1])) ? 1 : 2;
+    const float* p0 = v[0];
+    const float* p1 = v[t];
+    const float* p2 = v[t + 1];
+    const float det = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (p1[1] - p0[1]);
+    const float da = ((p1[2] - p0[2]) * (p2[1] - p0[1]) - (p2[2] - p0[2]) * (p1[1] - p0[1])) / det;
+    const float db = ((p2[2] - p0[2]) * (p1[0] - p0[0]) - (p1[2] - p0[2]) * (p2[0] - p0[0])) / det;
+    const float dc = p0[2] - da * p0[0] - db * p0[1] + fminf(da, 0.0f) + fminf(db, 0.0f);
+
+    float minX = v[0][0], maxX = v[0][0], minY = v[0][1], maxY = v[0][1];
+    for (int i = 1; i < 4; ++i)
+    {
+        minX = fminf(minX, v[i][0]);
+        maxX = fmaxf(maxX, v[i][0]);
+        minY = fminf(minY, v[i][1]);
+        maxY = fmaxf(maxY, v[i][1]);
+    }
+
+    // x is widened to whole groups of 4 for the SIMD path; the extra pixels fail the edge tests
+    const int x0 = clamp_to_buffer(floorf(minX), OCCLUSION_BUFFER_WIDTH) & ~3;
+    const int x1 = (clamp_to_buffer(ceilf(maxX), OCCLUSION_BUFFER_WIDTH) + 3) & ~3;
+    const int y0 = clamp_to_buffer(floorf(minY), OCCLUSION_BUFFER_HEIGHT);
+    const int y1 = clamp_to_buffer(ceilf(maxY), OCCLUSION_BUFFER_HEIGHT);
+
+    for (int y = y0; y < y1; ++y)
+    {
+        float* row = &buffer->depths[y * OCCLUSION_BUFFER_WIDTH];
+        int x = x0;
+
+#ifdef OCCLUSION_SIMD_X86
+        const __m128 steps = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        for (; x < x1; x += 4)
+        {
+            const __m128 xs = _mm_add_ps(_mm_set1_ps((float)x), steps);
+            const __m128 invDepth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(da), xs), _mm_set1_ps(db * y + dc));
+            __m128 inside = _mm_cmpgt_ps(invDepth, _mm_setzero_ps());
+            for (int e = 0; e < 4; ++e)
+            {
+                const __m128 f = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ea[e]), xs), _mm_set1_ps(eb[e] * y + ec[e]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(f, _mm_setzero_ps()));
+            }
+            if (!_mm_movemask_ps(inside))
+                continue;
+
+            const __m128 old = _mm_loadu_ps(row + x);
+            const __m128 nearest = _mm_min_ps(old, _mm_div_ps(_mm_set1_ps(1.0f), invDepth));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+        }
+#endif
+
+        for (; x < x1; ++x)
+        {
+            int bIsInside = TRUE;
+            for (int e = 0; e < 4; ++e)
+                bIsInside &= ea[e] * x + eb[e] * y + ec[e] >= 0.0f;
+
+            const float invDepth = da * x + db * y + dc;
+            if (bIsInside && invDepth > 0.0f && 1.0f / invDepth < row[x])
+                row[x] = 1.0f / invDepth;
+        }
+    }
+}
+
+int occlusion_test_box(const OcclusionBuffer* buffer, const float* boxMin, const float* boxMax)
+{
+    float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minDepth = FLT_MAX;
+    for (int c = 0; c < 8; ++c)
+    {
+        const float corner[3] = {
+            c & 1 ? boxMax[0] : boxMin[0],
+            c & 2 ? boxMax[1] : boxMin[1],
+            c & 4 ? boxMax[2] : boxMin[2],
+        };
+
+        float p[3];
+        if (!project_point(buffer->clip, corner, p))
+            return TRUE;
+
+        minX = fminf(minX, p[0]);
+        maxX = fmaxf(maxX, p[0]);
+        minY = fminf(minY, p[1]);
+        maxY = fmaxf(maxY, p[1]);
+        minDepth = fminf(minDepth, 1.0f / p[2]);
+    }
+
+    // Every pixel the box touches and those around them, since occluder edges can leave part of a pixel
+    // they are counted as covering uncovered
+    const int x0 = clamp_to_buffer(floorf(minX) - 1.0f, OCCLUSION_BUFFER_WIDTH);
+    const int x1 = clamp_to_buffer(ceilf(maxX) + 1.0f, OCCLUSION_BUFFER_WIDTH);
+    const int y0 = clamp_to_buffer(floorf(minY) - 1.0f, OCCLUSION_BUFFER_HEIGHT);
+    const int y1 = clamp_to_buffer(ceilf(maxY) + 1.0f, OCCLUSION_BUFFER_HEIGHT);
+    if (x0 >= x1 || y0 >= y1)
+        return TRUE;
+
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x)
+            if (buffer->depths[y * OCCLUSION_BUFFER_WIDTH + x] >= minDepth)
+                return TRUE;
+
+    return FALSE;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+// Low resolution software depth buffer for CPU occlusion culling. Occluders are convex quads that must
+// lie inside solid geometry. Coverage is sampled at pixel centres so neighbouring quads leave no gaps,
+// and each pixel takes the quad's furthest depth across it. A pixel on an occluder's edge can still be
+// partly uncovered, so boxes are tested against every pixel they touch and a border of one more.
+
+#define OCCLUSION_BUFFER_WIDTH 192 // must be a multiple of 4
+#define OCCLUSION_BUFFER_HEIGHT 128
+#define OCCLUSION_MIN_DEPTH 0.1f // anything nearer (or behind the camera) is never culled or rasterised
+
+typedef struct OcclusionBuffer {
+    float clip[16]; // projection * view, column-major
+    float* depths; // view depth of the nearest occluder covering each pixel, row-major from the bottom
+} OcclusionBuffer;
+
+void occlusion_init(OcclusionBuffer* out);
+
+void occlusion_destroy(OcclusionBuffer* buffer);
+
+// Empties the buffer and sets the view it is rasterised and tested from
+void occlusion_clear(OcclusionBuffer* buffer, const float* clip);
+
+// corners holds four xyz points around a planar convex quad, counter-clockwise when seen from the front.
+// Quads seen from behind are skipped, so closed occluders need only list their outward faces.
+void occlusion_rasterise_quad(OcclusionBuffer* buffer, const float* corners);
+
+// Returns FALSE if the box is certainly hidden behind the occluders rasterised so far
+int occlusion_test_box(const OcclusionBuffer* buffer, const float* boxMin, const float* boxMax);
+
+#endif
\ No newline at end of file
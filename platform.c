@@ -1,9 +1,14 @@
-#define GLAD_GL_IMPLEMENTATION
-#include "gl.h"
+#ifdef _WIN32
 
+#include "glutils.h"
 #include "logging.h"
 #include "platform.h"
 
+// gl.h is already in through glutils.h, so this only adds glad's implementation, which is not include
+// guarded
+#define GLAD_GL_IMPLEMENTATION
+#include "gl.h"
+
 typedef HGLRC WINAPI wglCreateContextAttribsARB_type(HDC hdc, HGLRC hShareContext,
 	const int *attribList);
 wglCreateContextAttribsARB_type *wglCreateContextAttribsARB;
@@ -32,6 +37,12 @@ wglChoosePixelFormatARB_type *wglChoosePixelFormatARB;
 #define WGL_FULL_ACCELERATION_ARB                 0x2027
 #define WGL_TYPE_RGBA_ARB                         0x202B
 
+struct PlatformWindow {
+	HWND hWnd;
+	HDC hDeviceContext;
+	HGLRC hRenderingContext;
+};
+
 typedef struct ExtraWindowData {
 	WindowKeyCallback* keyCallback;
 	WindowMouseMoveCallback* mouseMoveCallback;
@@ -134,6 +145,16 @@ void init_wgl_extensions()
 	DestroyWindow(hWnd);
 }
 
+// wglGetProcAddress only knows extension and post 1.1 entry points, and some drivers signal failure with
+// small integers rather than NULL
+GLADapiproc get_gl_proc_address(const char* name)
+{
+	PROC proc = wglGetProcAddress(name);
+	if ((INT_PTR)proc >= -1 && (INT_PTR)proc <= 3)
+		return NULL;
+	return (GLADapiproc)proc;
+}
+
 HGLRC init_opengl(HDC hDeviceContext, int glVersionMajor, int glVersionMinor)
 {
 	init_wgl_extensions();
@@ -181,6 +202,8 @@ HGLRC init_opengl(HDC hDeviceContext, int glVersionMajor, int glVersionMinor)
 	if (!gladLoaderLoadGL())
 		LOGFATAL("Failed to load OpenGL function pointers.");
 
+	gut_load_extensions(get_gl_proc_address);
+
 	glEnable(GL_DEPTH_TEST);
 
 	return hRenderingContext;
@@ -190,7 +213,10 @@ LRESULT CALLBACK wnd_proc(HWND hWnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
 	LRESULT result = 0;
 
+	// No data is attached until create_window sets it, and none is left after WM_DESTROY frees it
 	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(hWnd, 0);
+	if (!windowData)
+		return DefWindowProcA(hWnd, msg, wparam, lparam);
 
 	switch (msg) {
 		case WM_KEYDOWN:
@@ -335,9 +361,11 @@ LRESULT CALLBACK wnd_proc(HWND hWnd, UINT msg, WPARAM wparam, LPARAM lparam)
 		}
 
 		case WM_CLOSE:
+			PostQuitMessage(0);
+			break;
 		case WM_DESTROY:
 			free(windowData);
-			PostQuitMessage(0);
+			SetWindowLongPtr(hWnd, 0, 0);
 			break;
 		default:
 			result = DefWindowProcA(hWnd, msg, wparam, lparam);
@@ -399,6 +427,32 @@ HWND create_window(HINSTANCE hInstance, int width, int height, const char* name)
 	return hWnd;
 }
 
+PlatformWindow* platform_create_window(int width, int height, const char* name, int glVersionMajor, int glVersionMinor)
+{
+	PlatformWindow* window = malloc(sizeof(PlatformWindow));
+	window->hWnd = create_window(GetModuleHandle(NULL), width, height, name);
+	window->hDeviceContext = GetDC(window->hWnd);
+	window->hRenderingContext = init_opengl(window->hDeviceContext, glVersionMajor, glVersionMinor);
+
+	ShowWindow(window->hWnd, SW_SHOW);
+	UpdateWindow(window->hWnd);
+	return window;
+}
+
+void platform_destroy_window(PlatformWindow* window)
+{
+	wglMakeCurrent(window->hDeviceContext, 0);
+	wglDeleteContext(window->hRenderingContext);
+	ReleaseDC(window->hWnd, window->hDeviceContext);
+	DestroyWindow(window->hWnd);
+	free(window);
+}
+
+void platform_swap_buffers(PlatformWindow* window)
+{
+	SwapBuffers(window->hDeviceContext);
+}
+
 int platform_process_events()
 {
 	MSG msg;
@@ -417,38 +471,93 @@ int platform_process_events()
 	return TRUE;
 }
 
-void platform_window_flush_input(HWND hWnd)
+int platform_load_input_script(const char* path)
 {
-	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(hWnd, 0);
+	LOG("Scripted input is only supported by the headless backend, ignoring %s.", path);
+	return FALSE;
+}
+
+void platform_window_flush_input(PlatformWindow* window)
+{
+	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(window->hWnd, 0);
 	windowData->inputState.mouse.deltaX = 0;
 	windowData->inputState.mouse.deltaY = 0;
 }
 
-void platform_set_window_key_callback(HWND hWnd, WindowKeyCallback* callback)
+void platform_set_window_key_callback(PlatformWindow* window, WindowKeyCallback* callback)
 {
-	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(hWnd, 0);
+	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(window->hWnd, 0);
 	windowData->keyCallback = callback;
 }
 
-void platform_set_window_mouse_move_callback(HWND hWnd, WindowMouseMoveCallback* callback)
+void platform_set_window_mouse_move_callback(PlatformWindow* window, WindowMouseMoveCallback* callback)
 {
-	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(hWnd, 0);
+	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(window->hWnd, 0);
 	windowData->mouseMoveCallback = callback;
 }
 
-void platform_set_window_mouse_button_callback(HWND hWnd, WindowMouseButtonCallback* callback)
+void platform_set_window_mouse_button_callback(PlatformWindow* window, WindowMouseButtonCallback* callback)
 {
-	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(hWnd, 0);
+	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(window->hWnd, 0);
 	windowData->mouseButtonCallback = callback;
 }
 
-const WindowInputState * platform_get_window_input_state(HWND hWnd)
+const WindowInputState * platform_get_window_input_state(PlatformWindow* window)
 {
-	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(hWnd, 0);
+	ExtraWindowData* windowData = (ExtraWindowData*)GetWindowLongPtr(window->hWnd, 0);
 	return &windowData->inputState;
 }
 
 int platform_get_key_is_down(int key)
 {
 	return GetAsyncKeyState(key) & 0x8000 == 0x8000;
-}
\ No newline at end of file
+}
+
+double platform_get_time()
+{
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+void platform_sleep(double seconds)
+{
+	// Sleep only wakes on the system timer tick, which is usually 15.6 ms apart. High resolution
+	// timers, on Windows 10 1803 and later, wake within a fraction of a millisecond.
+	static HANDLE hTimer;
+	static int bHasTriedTimer;
+	if (!bHasTriedTimer)
+	{
+		hTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		bHasTriedTimer = TRUE;
+	}
+
+	if (hTimer)
+	{
+		// Negative due times are relative, in 100 ns intervals
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -(LONGLONG)(seconds * 1e7);
+		if (SetWaitableTimer(hTimer, &dueTime, 0, NULL, NULL, FALSE))
+		{
+			WaitForSingleObject(hTimer, INFINITE);
+			return;
+		}
+	}
+
+	Sleep((DWORD)(seconds * 1000.0));
+}
+
+int platform_create_directory(const char* path)
+{
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+#endif
\ No newline at end of file
@@ -1,8 +1,10 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#endif
 
 typedef enum {
 	KEY_UNDEFINED = -1,
@@ -142,22 +144,49 @@ typedef struct WindowInputState {
 	MouseState mouse;
 } WindowInputState;
 
-HGLRC init_opengl(HDC hDeviceContext, int glVersionMajor, int glVersionMinor);
+// A window whose GL context is current on the thread that created it. On Windows this is a real window.
+// Elsewhere the headless backend renders offscreen through EGL, and its input comes from a script.
+typedef struct PlatformWindow PlatformWindow;
 
-HWND create_window(HINSTANCE hInstance, int width, int height, const char* name);
+// Creates the window and a core profile context of at least the given version, and loads GL
+PlatformWindow* platform_create_window(int width, int height, const char* name, int glVersionMajor, int glVersionMinor);
 
+void platform_destroy_window(PlatformWindow* window);
+
+void platform_swap_buffers(PlatformWindow* window);
+
+// Returns FALSE once the application should quit
 int platform_process_events();
 
-void platform_window_flush_input(HWND hWnd);
+// Replays input from a text file instead of the keyboard and mouse, one event per line:
+//     <frame> key_down|key_up <key>          key as in the Key enum without KEY_, e.g. W or LEFT_SHIFT
+//     <frame> mouse_down|mouse_up <button>   left, right or middle
+//     <frame> mouse_move <dx> <dy>
+//     <frame> quit
+// where frame counts calls to platform_process_events from 0. Lines starting with # are ignored, and
+// events must be in frame order. Returns FALSE if the file could not be read or this backend has no
+// scripted input.
+int platform_load_input_script(const char* path);
+
+void platform_window_flush_input(PlatformWindow* window);
 
-void platform_set_window_key_callback(HWND hWnd, WindowKeyCallback* callback);
+void platform_set_window_key_callback(PlatformWindow* window, WindowKeyCallback* callback);
 
-void platform_set_window_mouse_move_callback(HWND hWnd, WindowMouseMoveCallback* callback);
+void platform_set_window_mouse_move_callback(PlatformWindow* window, WindowMouseMoveCallback* callback);
 
-void platform_set_window_mouse_button_callback(HWND hWnd, WindowMouseButtonCallback* callback);
+void platform_set_window_mouse_button_callback(PlatformWindow* window, WindowMouseButtonCallback* callback);
 
-const WindowInputState * platform_get_window_input_state(HWND hWnd);
+const WindowInputState * platform_get_window_input_state(PlatformWindow* window);
 
 int platform_get_key_is_down(int key);
 
+// Seconds on a monotonic high-resolution clock, with an arbitrary origin
+double platform_get_time();
+
+// Blocks the calling thread for about this many seconds. It may wake a little late, never early.
+void platform_sleep(double seconds);
+
+// Returns TRUE if the directory exists afterwards, whether or not it was created now
+int platform_create_directory(const char* path);
+
 #endif
\ No newline at end of file
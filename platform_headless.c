@@ -0,0 +1,404 @@
+#ifndef _WIN32
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "glutils.h"
+#include "logging.h"
+#include "macromagic.h"
+#include "platform.h"
+
+// gl.h is already in through glutils.h, so this only adds glad's implementation, which is not include
+// guarded
+#define GLAD_GL_IMPLEMENTATION
+#include "gl.h"
+
+// There is nothing to present a pbuffer to, so swaps throttle on fences instead, letting the GPU fall
+// this many frames behind as a swap chain would
+#define HEADLESS_FRAMES_IN_FLIGHT 2
+
+struct PlatformWindow {
+	EGLDisplay eglDisplay;
+	EGLContext eglContext;
+	EGLSurface eglSurface;
+	GLsync glFrameFences[HEADLESS_FRAMES_IN_FLIGHT];
+	int nextFrameFence;
+	WindowKeyCallback* keyCallback;
+	WindowMouseMoveCallback* mouseMoveCallback;
+	WindowMouseButtonCallback* mouseButtonCallback;
+	WindowInputState inputState;
+};
+
+typedef enum {
+	SCRIPT_EVENT_KEY,
+	SCRIPT_EVENT_MOUSE_BUTTON,
+	SCRIPT_EVENT_MOUSE_MOVE,
+	SCRIPT_EVENT_QUIT
+} ScriptEventType;
+
+typedef struct ScriptEvent {
+	unsigned int frame;
+	ScriptEventType type;
+	int code; // Key or MouseButton
+	ButtonAction action;
+	int deltaX;
+	int deltaY;
+} ScriptEvent;
+
+// Names of the Key enum's values without KEY_, in order
+const char* keyNames[_KEY_MAX] = {
+	"0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+	"NUMPAD_0", "NUMPAD_1", "NUMPAD_2", "NUMPAD_3", "NUMPAD_4",
+	"NUMPAD_5", "NUMPAD_6", "NUMPAD_7", "NUMPAD_8", "NUMPAD_9",
+	"A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M",
+	"N", "O", "P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z",
+	"ESC", "GRAVE_ACCENT", "TAB", "CAPS_LOCK", "LEFT_SHIFT", "RIGHT_SHIFT",
+	"LEFT_CONTROL", "RIGHT_CONTROL", "ALT", "SPACE", "LEFT", "RIGHT", "UP", "DOWN",
+	"HOME", "END", "INSERT", "DELETE", "ENTER", "BACKSPACE", "DASH", "EQUALS",
+	"LEFT_BRACE", "RIGHT_BRACE", "SEMI_COLON", "SINGLE_QUOTE", "TILDE", "COMMA",
+	"PERIOD", "BACKWARD_SLASH", "FORWARD_SLASH",
+};
+
+// There is only ever the one window, which scripted events are sent to
+PlatformWindow* headlessWindow;
+
+ScriptEvent* scriptEvents;
+int numScriptEvents;
+int nextScriptEvent;
+unsigned int scriptFrame;
+
+// eglGetProcAddress returns core entry points too on Mesa, and everywhere with EGL 1.5
+GLADapiproc get_gl_proc_address(const char* name)
+{
+	return (GLADapiproc)eglGetProcAddress(name);
+}
+
+PlatformWindow* platform_create_window(int width, int height, const char* name, int glVersionMajor, int glVersionMinor)
+{
+	PlatformWindow* window = calloc(1, sizeof(PlatformWindow));
+
+	// Mesa's surfaceless platform needs no display server or GPU, otherwise take the default display
+	window->eglDisplay = EGL_NO_DISPLAY;
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (eglGetPlatformDisplayEXT && clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+		window->eglDisplay = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (window->eglDisplay == EGL_NO_DISPLAY)
+		window->eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (window->eglDisplay == EGL_NO_DISPLAY || !eglInitialize(window->eglDisplay, NULL, NULL))
+		LOGFATAL("Failed to initialise EGL.");
+	if (!eglBindAPI(EGL_OPENGL_API))
+		LOGFATAL("EGL has no desktop OpenGL.");
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE,        8,
+		EGL_GREEN_SIZE,      8,
+		EGL_BLUE_SIZE,       8,
+		EGL_ALPHA_SIZE,      8,
+		EGL_DEPTH_SIZE,      24,
+		EGL_STENCIL_SIZE,    8,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint numConfigs;
+	if (!eglChooseConfig(window->eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+		LOGFATAL("Failed to find an EGL config for an OpenGL pbuffer.");
+
+	const EGLint surfaceAttribs[] = {
+		EGL_WIDTH,  width,
+		EGL_HEIGHT, height,
+		EGL_NONE
+	};
+
+	window->eglSurface = eglCreatePbufferSurface(window->eglDisplay, config, surfaceAttribs);
+	if (window->eglSurface == EGL_NO_SURFACE)
+		LOGFATAL("Failed to create a %dx%d pbuffer.", width, height);
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR,       glVersionMajor,
+		EGL_CONTEXT_MINOR_VERSION_KHR,       glVersionMinor,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+
+	window->eglContext = eglCreateContext(window->eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+	if (window->eglContext == EGL_NO_CONTEXT)
+		LOGFATAL("Failed to create OpenGL context.");
+
+	if (!eglMakeCurrent(window->eglDisplay, window->eglSurface, window->eglSurface, window->eglContext))
+		LOGFATAL("Failed to make OpenGL context current.");
+
+	if (!gladLoadGL(get_gl_proc_address))
+		LOGFATAL("Failed to load OpenGL function pointers.");
+
+	gut_load_extensions(get_gl_proc_address);
+
+	glEnable(GL_DEPTH_TEST);
+
+	LOG("Headless \"%s\" on %s.", name, (const char*)glGetString(GL_RENDERER));
+	headlessWindow = window;
+	return window;
+}
+
+void platform_destroy_window(PlatformWindow* window)
+{
+	for (int i = 0; i < HEADLESS_FRAMES_IN_FLIGHT; ++i)
+		if (window->glFrameFences[i])
+			glDeleteSync(window->glFrameFences[i]);
+
+	eglMakeCurrent(window->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(window->eglDisplay, window->eglContext);
+	eglDestroySurface(window->eglDisplay, window->eglSurface);
+	eglTerminate(window->eglDisplay);
+	if (headlessWindow == window)
+		headlessWindow = NULL;
+	free(window);
+}
+
+void platform_swap_buffers(PlatformWindow* window)
+{
+	GLsync* fence = &window->glFrameFences[window->nextFrameFence];
+	if (*fence)
+	{
+		glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(*fence);
+	}
+
+	*fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	window->nextFrameFence = (window->nextFrameFence + 1) % HEADLESS_FRAMES_IN_FLIGHT;
+}
+
+void dispatch_script_event(PlatformWindow* window, const ScriptEvent* event)
+{
+	WindowInputState* input = &window->inputState;
+	switch (event->type)
+	{
+		case SCRIPT_EVENT_KEY:
+		{
+			input->keys[event->code].bIsDown = event->action == BUTTON_ACTION_PRESS;
+			if (window->keyCallback)
+			{
+				WindowKeyEventData e;
+				e.key = (Key)event->code;
+				e.action = event->action;
+				window->keyCallback(e);
+			}
+			break;
+		}
+
+		case SCRIPT_EVENT_MOUSE_BUTTON:
+		{
+			input->mouse.buttons[event->code].bIsDown = event->action == BUTTON_ACTION_PRESS;
+			if (window->mouseButtonCallback)
+			{
+				WindowMouseButtonEventData e;
+				e.button = (MouseButton)event->code;
+				e.action = event->action;
+				window->mouseButtonCallback(e);
+			}
+			break;
+		}
+
+		case SCRIPT_EVENT_MOUSE_MOVE:
+		{
+			input->mouse.deltaX += event->deltaX;
+			input->mouse.deltaY += event->deltaY;
+			input->mouse.clientX += event->deltaX;
+			input->mouse.clientY += event->deltaY;
+			if (window->mouseMoveCallback)
+			{
+				WindowMouseMoveEventData e;
+				e.x = input->mouse.clientX;
+				e.y = input->mouse.clientY;
+				e.deltaX = input->mouse.deltaX;
+				e.deltaY = input->mouse.deltaY;
+				window->mouseMoveCallback(e);
+			}
+			break;
+		}
+
+		case SCRIPT_EVENT_QUIT:
+			break;
+	}
+}
+
+int platform_process_events()
+{
+	int bIsRunning = TRUE;
+	while (nextScriptEvent < numScriptEvents && scriptEvents[nextScriptEvent].frame <= scriptFrame)
+	{
+		const ScriptEvent* event = &scriptEvents[nextScriptEvent++];
+		if (event->type == SCRIPT_EVENT_QUIT)
+			bIsRunning = FALSE;
+		else if (headlessWindow)
+			dispatch_script_event(headlessWindow, event);
+	}
+
+	scriptFrame++;
+	return bIsRunning;
+}
+
+// Returns FALSE if the line is not a valid event
+int parse_script_event(const char* line, ScriptEvent* out)
+{
+	char type[32], arg[32];
+	int numArgs = sscanf(line, "%u %31s %31s", &out->frame, type, arg);
+	if (numArgs < 2)
+		return FALSE;
+
+	if (strcmp(type, "quit") == 0)
+	{
+		out->type = SCRIPT_EVENT_QUIT;
+		return TRUE;
+	}
+
+	if (strcmp(type, "mouse_move") == 0)
+	{
+		out->type = SCRIPT_EVENT_MOUSE_MOVE;
+		return sscanf(line, "%*u %*s %d %d", &out->deltaX, &out->deltaY) == 2;
+	}
+
+	if (numArgs < 3)
+		return FALSE;
+
+	if (strcmp(type, "key_down") == 0 || strcmp(type, "key_up") == 0)
+	{
+		out->type = SCRIPT_EVENT_KEY;
+		out->action = type[4] == 'd' ? BUTTON_ACTION_PRESS : BUTTON_ACTION_RELEASE;
+		for (int k = 0; k < _KEY_MAX; ++k)
+			if (strcmp(keyNames[k], arg) == 0)
+			{
+				out->code = k;
+				return TRUE;
+			}
+		return FALSE;
+	}
+
+	if (strcmp(type, "mouse_down") == 0 || strcmp(type, "mouse_up") == 0)
+	{
+		out->type = SCRIPT_EVENT_MOUSE_BUTTON;
+		out->action = type[6] == 'd' ? BUTTON_ACTION_PRESS : BUTTON_ACTION_RELEASE;
+		if (strcmp(arg, "left") == 0)
+			out->code = MOUSE_BUTTON_LEFT;
+		else if (strcmp(arg, "right") == 0)
+			out->code = MOUSE_BUTTON_RIGHT;
+		else if (strcmp(arg, "middle") == 0)
+			out->code = MOUSE_BUTTON_MIDDLE;
+		else
+			return FALSE;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+int platform_load_input_script(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return FALSE;
+
+	int capacity = 64;
+	ScriptEvent* events = malloc(sizeof(ScriptEvent) * capacity);
+	int numEvents = 0;
+
+	char line[256];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		lineNumber++;
+		const char* c = line;
+		while (isspace((unsigned char)*c))
+			c++;
+		if (*c == '\0' || *c == '#')
+			continue;
+
+		if (numEvents == capacity)
+		{
+			capacity *= 2;
+			events = realloc(events, sizeof(ScriptEvent) * capacity);
+		}
+
+		ScriptEvent* event = &events[numEvents];
+		if (!parse_script_event(c, event))
+			LOG("%s:%d: not an input event, skipped.", path, lineNumber);
+		else if (numEvents > 0 && event->frame < events[numEvents - 1].frame)
+			LOG("%s:%d: event is before the one above it, skipped.", path, lineNumber);
+		else
+			numEvents++;
+	}
+	fclose(file);
+
+	free(scriptEvents);
+	scriptEvents = events;
+	numScriptEvents = numEvents;
+	nextScriptEvent = 0;
+	scriptFrame = 0;
+	return TRUE;
+}
+
+void platform_window_flush_input(PlatformWindow* window)
+{
+	window->inputState.mouse.deltaX = 0;
+	window->inputState.mouse.deltaY = 0;
+}
+
+void platform_set_window_key_callback(PlatformWindow* window, WindowKeyCallback* callback)
+{
+	window->keyCallback = callback;
+}
+
+void platform_set_window_mouse_move_callback(PlatformWindow* window, WindowMouseMoveCallback* callback)
+{
+	window->mouseMoveCallback = callback;
+}
+
+void platform_set_window_mouse_button_callback(PlatformWindow* window, WindowMouseButtonCallback* callback)
+{
+	window->mouseButtonCallback = callback;
+}
+
+const WindowInputState * platform_get_window_input_state(PlatformWindow* window)
+{
+	return &window->inputState;
+}
+
+int platform_get_key_is_down(int key)
+{
+	return headlessWindow && key >= 0 && key < _KEY_MAX && headlessWindow->inputState.keys[key].bIsDown;
+}
+
+double platform_get_time()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+void platform_sleep(double seconds)
+{
+	struct timespec duration;
+	duration.tv_sec = (time_t)seconds;
+	duration.tv_nsec = (long)((seconds - (double)duration.tv_sec) * 1e9);
+	while (nanosleep(&duration, &duration) == -1 && errno == EINTR);
+}
+
+int platform_create_directory(const char* path)
+{
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "profiler.h"
+
+#ifdef ENABLE_PROFILING
+
+#include "platform.h"
+
+ProfileThread* _Atomic profileThreads[PROFILER_MAX_THREADS];
+atomic_int profileNumThreads;
+
+// Main thread only, from here down
+ProfileEvent profileEvents[PROFILER_RING_SIZE]; // one thread's ring as it is collected
+ProfileNode profileNodes[PROFILER_MAX_NODES];
+int profileNumNodes;
+unsigned int profileNumDropped;
+
+FILE* profileTraceFile;
+double profileTraceOrigin;
+int bHasTraceEvents;
+
+// Returns NULL on threads beyond PROFILER_MAX_THREADS, whose scopes go unrecorded
+ProfileThread* get_profile_thread()
+{
+    static _Thread_local ProfileThread* thread;
+    static _Thread_local int bIsRegistered;
+    if (!bIsRegistered)
+    {
+        bIsRegistered = TRUE;
+        const int id = atomic_fetch_add(&profileNumThreads, 1);
+        if (id < PROFILER_MAX_THREADS)
+        {
+            thread = (ProfileThread*)calloc(1, sizeof(ProfileThread));
+            thread->id = id;
+            atomic_store_explicit(&profileThreads[id], thread, memory_order_release);
+        }
+    }
+    return thread;
+}
+
+ProfileScope profiler_begin_scope(const char* name)
+{
+    ProfileThread* thread = get_profile_thread();
+    if (thread)
+        thread->depth++;
+
+    ProfileScope scope = { name, platform_get_time() };
+    return scope;
+}
+
+void profiler_end_scope(ProfileScope* scope)
+{
+    const double end = platform_get_time();
+    ProfileThread* thread = get_profile_thread();
+    if (!thread)
+        return;
+
+    thread->depth--;
+    const unsigned int write = atomic_load_explicit(&thread->writeIndex, memory_order_relaxed);
+    if (write - atomic_load_explicit(&thread->readIndex, memory_order_acquire) == PROFILER_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&thread->numDropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    ProfileEvent* event = &thread->events[write & (PROFILER_RING_SIZE - 1)];
+    event->name = scope->name;
+    event->start = scope->start;
+    event->end = end;
+    event->depth = thread->depth;
+    atomic_store_explicit(&thread->writeIndex, write + 1, memory_order_release);
+}
+
+int profiler_start_trace(const char* path)
+{
+    profileTraceFile = fopen(path, "w");
+    if (!profileTraceFile)
+        return FALSE;
+
+    profileTraceOrigin = platform_get_time();
+    bHasTraceEvents = FALSE;
+    fputs("{\"traceEvents\":[", profileTraceFile);
+    return TRUE;
+}
+
+int compare_profile_events(const void* a, const void* b)
+{
+    const ProfileEvent* lhs = (const ProfileEvent*)a;
+    const ProfileEvent* rhs = (const ProfileEvent*)b;
+    if (lhs->start != rhs->start)
+        return lhs->start < rhs->start ? -1 : 1;
+    return lhs->depth - rhs->depth;
+}
+
+// Returns -1 once the summary is full
+int get_profile_node(const char* name, int parent)
+{
+    for (int i = 0; i < profileNumNodes; ++i)
+        if (profileNodes[i].parent == parent && strcmp(profileNodes[i].name, name) == 0)
+            return i;
+
+    if (profileNumNodes == PROFILER_MAX_NODES)
+        return -1;
+
+    ProfileNode* node = &profileNodes[profileNumNodes];
+    node->name = name;
+    node->parent = parent;
+    node->numCalls = 0;
+    node->totalTime = 0.0;
+    return profileNumNodes++;
+}
+
+void collect_thread_events(ProfileThread* thread)
+{
+    const unsigned int read = atomic_load_explicit(&thread->readIndex, memory_order_relaxed);
+    const unsigned int write = atomic_load_explicit(&thread->writeIndex, memory_order_acquire);
+    const int numEvents = (int)(write - read);
+    for (int i = 0; i < numEvents; ++i)
+        profileEvents[i] = thread->events[(read + i) & (PROFILER_RING_SIZE - 1)];
+    atomic_store_explicit(&thread->readIndex, write, memory_order_release);
+    profileNumDropped += atomic_exchange_explicit(&thread->numDropped, 0, memory_order_relaxed);
+
+    // Scopes are recorded as they end, so inner ones come before the scopes around them. Sorted by when
+    // they began, each scope's parent is the last one seen a level up, as long as that one encloses it;
+    // it may not if the parent is still running and will only be collected in a later frame.
+    qsort(profileEvents, numEvents, sizeof(ProfileEvent), compare_profile_events);
+
+    int nodeStack[PROFILER_MAX_DEPTH];
+    double endStack[PROFILER_MAX_DEPTH];
+    for (int d = 0; d < PROFILER_MAX_DEPTH; ++d)
+        endStack[d] = -1.0;
+
+    for (int i = 0; i < numEvents; ++i)
+    {
+        const ProfileEvent* event = &profileEvents[i];
+        const int depth = event->depth;
+        const int parent = depth > 0 && depth <= PROFILER_MAX_DEPTH && endStack[depth - 1] >= event->end ?
+            nodeStack[depth - 1] : -1;
+        const int node = get_profile_node(event->name, parent);
+        if (node >= 0)
+        {
+            profileNodes[node].numCalls++;
+            profileNodes[node].totalTime += event->end - event->start;
+        }
+        if (depth < PROFILER_MAX_DEPTH)
+        {
+            nodeStack[depth] = node;
+            endStack[depth] = event->end;
+        }
+
+        if (profileTraceFile && event->start >= profileTraceOrigin)
+        {
+            fprintf(profileTraceFile, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                bHasTraceEvents ? "," : "", event->name, thread->id,
+                (event->start - profileTraceOrigin) * 1e6, (event->end - event->start) * 1e6);
+            bHasTraceEvents = TRUE;
+        }
+    }
+}
+
+void profiler_end_frame()
+{
+    profileNumNodes = 0;
+    profileNumDropped = 0;
+
+    int numThreads = atomic_load(&profileNumThreads);
+    if (numThreads > PROFILER_MAX_THREADS)
+        numThreads = PROFILER_MAX_THREADS;
+
+    for (int i = 0; i < numThreads; ++i)
+    {
+        // NULL if the thread has only just registered
+        ProfileThread* thread = atomic_load_explicit(&profileThreads[i], memory_order_acquire);
+        if (thread)
+            collect_thread_events(thread);
+    }
+}
+
+void profiler_record_time(const char* name, double seconds)
+{
+    const int node = get_profile_node(name, -1);
+    if (node >= 0)
+    {
+        profileNodes[node].numCalls++;
+        profileNodes[node].totalTime += seconds;
+    }
+
+    if (profileTraceFile)
+    {
+        fprintf(profileTraceFile, "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"ts\":%.3f,\"args\":{\"ms\":%.3f}}",
+            bHasTraceEvents ? "," : "", name, (platform_get_time() - profileTraceOrigin) * 1e6, seconds * 1000.0);
+        bHasTraceEvents = TRUE;
+    }
+}
+
+void log_profile_nodes(int parent, int depth)
+{
+    for (int i = 0; i < profileNumNodes; ++i)
+    {
+        const ProfileNode* node = &profileNodes[i];
+        if (node->parent != parent)
+            continue;
+
+        LOG("%*s%s: %.3f ms (%d)", depth * 2, "", node->name, node->totalTime * 1000.0, node->numCalls);
+        log_profile_nodes(i, depth + 1);
+    }
+}
+
+void profiler_log_summary()
+{
+    LOG("Scopes ended last frame, in ms summed over every call on every thread:");
+    log_profile_nodes(-1, 1);
+    if (profileNumDropped > 0)
+        LOG("%u scopes were dropped on threads whose rings were full.", profileNumDropped);
+}
+
+void profiler_destroy()
+{
+    profiler_end_frame();
+
+    if (profileTraceFile)
+    {
+        fputs("\n]}\n", profileTraceFile);
+        fclose(profileTraceFile);
+        profileTraceFile = NULL;
+    }
+
+    for (int i = 0; i < PROFILER_MAX_THREADS; ++i)
+    {
+        free(atomic_load(&profileThreads[i]));
+        atomic_store(&profileThreads[i], NULL);
+    }
+}
+
+#endif
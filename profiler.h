@@ -0,0 +1,80 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Scoped CPU profiler. PROFILE_SCOPE("name") times from where it is declared to the end of the enclosing
+// block. Each thread records into its own ring, written only by that thread and read only by
+// profiler_end_frame, so recording a scope takes no locks. A full ring drops scopes rather than wait.
+// Only the name's pointer is kept, so names must be string literals, and they are written to the trace
+// as they are, so without quotes or backslashes.
+
+#define ENABLE_PROFILING
+#ifdef ENABLE_PROFILING
+
+#include <stdatomic.h>
+
+#include "macromagic.h"
+
+#define PROFILER_MAX_THREADS 64
+#define PROFILER_RING_SIZE 4096 // scopes per thread between calls to profiler_end_frame, a power of two
+#define PROFILER_MAX_NODES 256 // distinct scope paths in a frame's summary, the rest are left out
+#define PROFILER_MAX_DEPTH 32 // scopes nested deeper are summarised as outermost ones
+
+typedef struct ProfileScope {
+    const char* name;
+    double start;
+} ProfileScope;
+
+typedef struct ProfileEvent {
+    const char* name;
+    double start;
+    double end;
+    int depth; // scopes the thread was already inside when this one began
+} ProfileEvent;
+
+typedef struct ProfileThread {
+    ProfileEvent events[PROFILER_RING_SIZE];
+    atomic_uint writeIndex;
+    atomic_uint readIndex;
+    atomic_uint numDropped;
+    int depth;
+    int id;
+} ProfileThread;
+
+// One scope path in a frame's summary, with the time of every call to it on every thread summed
+typedef struct ProfileNode {
+    const char* name;
+    int parent; // -1 for outermost scopes
+    int numCalls;
+    double totalTime;
+} ProfileNode;
+
+ProfileScope profiler_begin_scope(const char* name);
+
+void profiler_end_scope(ProfileScope* scope);
+
+#define PROFILE_SCOPE(name) \
+    ProfileScope CAT(profileScope, __LINE__) __attribute__((cleanup(profiler_end_scope))) = profiler_begin_scope(name)
+
+// Streams every scope recorded from now on to path as Chrome trace_event JSON, which can be opened in
+// chrome://tracing or Perfetto. Returns FALSE if the file could not be opened.
+int profiler_start_trace(const char* path);
+
+// Collects the scopes every thread has finished since the last call into the frame's summary and the
+// trace. Call once per frame from the main thread, outside any scope.
+void profiler_end_frame();
+
+// Adds a time measured some other way, such as on the GPU, to the frame's summary as an outermost entry,
+// and to the trace as a counter. Main thread only, after profiler_end_frame.
+void profiler_record_time(const char* name, double seconds);
+
+// Logs the summary of the last frame collected as an indented tree
+void profiler_log_summary();
+
+// Finishes the trace. Call after every other thread that recorded scopes has stopped.
+void profiler_destroy();
+
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif
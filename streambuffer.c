@@ -0,0 +1,155 @@
+#include <stdlib.h>
+
+#include "glutils.h"
+#include "macromagic.h"
+#include "streambuffer.h"
+
+void stream_buffer_init(StreamBuffer* out, size_t size)
+{
+    out->size = size;
+    out->head = 0;
+    out->tail = 0;
+    out->firstAllocation = 0;
+    out->numAllocations = 0;
+    out->firstFence = 0;
+    out->numFences = 0;
+    out->frame = 1;
+    out->completedFrame = 0;
+    out->bHasReleasesThisFrame = FALSE;
+
+    out->glBuffer = 0;
+    out->data = NULL;
+    if (gutExtensions.glBufferStorage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &out->glBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, out->glBuffer);
+        gutExtensions.glBufferStorage(GL_COPY_READ_BUFFER, (GLsizeiptr)size, NULL, flags);
+        out->data = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)size, flags);
+        if (!out->data)
+        {
+            LOG("Failed to map the stream buffer, falling back to glBufferSubData.");
+            glDeleteBuffers(1, &out->glBuffer);
+            out->glBuffer = 0;
+        }
+    }
+
+    if (!out->glBuffer)
+        out->data = (unsigned char*)malloc(size);
+}
+
+void stream_buffer_destroy(StreamBuffer* buffer)
+{
+    for (int i = 0; i < buffer->numFences; ++i)
+        glDeleteSync(buffer->fences[(buffer->firstFence + i) % STREAM_BUFFER_MAX_FRAMES].glSync);
+    buffer->numFences = 0;
+
+    if (buffer->glBuffer)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer->glBuffer);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glDeleteBuffers(1, &buffer->glBuffer);
+        buffer->glBuffer = 0;
+    }
+    else
+        free(buffer->data);
+    buffer->data = NULL;
+}
+
+// Frees ranges from the oldest up to the first the GPU may still be reading
+void reclaim_ranges(StreamBuffer* buffer)
+{
+    while (buffer->numAllocations > 0)
+    {
+        const StreamBufferAllocation* allocation = &buffer->allocations[buffer->firstAllocation % STREAM_BUFFER_MAX_RANGES];
+        if (!allocation->bIsReleased || (buffer->glBuffer && allocation->releaseFrame > buffer->completedFrame))
+            break;
+
+        buffer->tail = allocation->end;
+        buffer->firstAllocation++;
+        buffer->numAllocations--;
+    }
+}
+
+int stream_buffer_allocate(StreamBuffer* buffer, size_t size, StreamBufferRange* out)
+{
+    if (buffer->numAllocations == STREAM_BUFFER_MAX_RANGES || size > buffer->size)
+        return FALSE;
+
+    // Ranges never wrap past the end of the ring, whatever is left there is skipped
+    size_t start = buffer->head;
+    if (start % buffer->size + size > buffer->size)
+        start += buffer->size - start % buffer->size;
+    if (start + size - buffer->tail > buffer->size)
+        return FALSE;
+
+    out->id = buffer->firstAllocation + buffer->numAllocations++;
+    out->offset = start % buffer->size;
+    out->size = size;
+    out->data = buffer->data + out->offset;
+
+    StreamBufferAllocation* allocation = &buffer->allocations[out->id % STREAM_BUFFER_MAX_RANGES];
+    allocation->end = start + size;
+    allocation->bIsReleased = FALSE;
+    buffer->head = start + size;
+    return TRUE;
+}
+
+void stream_buffer_copy(const StreamBuffer* buffer, const StreamBufferRange* range, GLuint glDestination, size_t destinationOffset)
+{
+    glBindBuffer(GL_COPY_WRITE_BUFFER, glDestination);
+    if (buffer->glBuffer)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer->glBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)range->offset, (GLintptr)destinationOffset, (GLsizeiptr)range->size);
+    }
+    else
+        glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)destinationOffset, (GLsizeiptr)range->size, range->data);
+}
+
+void stream_buffer_release(StreamBuffer* buffer, const StreamBufferRange* range)
+{
+    StreamBufferAllocation* allocation = &buffer->allocations[range->id % STREAM_BUFFER_MAX_RANGES];
+    allocation->bIsReleased = TRUE;
+    allocation->releaseFrame = buffer->frame;
+    buffer->bHasReleasesThisFrame = TRUE;
+    reclaim_ranges(buffer);
+}
+
+void stream_buffer_end_frame(StreamBuffer* buffer)
+{
+    if (buffer->glBuffer && buffer->bHasReleasesThisFrame)
+    {
+        // Too far behind, wait for the oldest frame rather than drop its fence
+        if (buffer->numFences == STREAM_BUFFER_MAX_FRAMES)
+        {
+            StreamBufferFence* oldest = &buffer->fences[buffer->firstFence];
+            glClientWaitSync(oldest->glSync, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(oldest->glSync);
+            buffer->completedFrame = oldest->frame;
+            buffer->firstFence = (buffer->firstFence + 1) % STREAM_BUFFER_MAX_FRAMES;
+            buffer->numFences--;
+        }
+
+        StreamBufferFence* fence = &buffer->fences[(buffer->firstFence + buffer->numFences++) % STREAM_BUFFER_MAX_FRAMES];
+        fence->glSync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        fence->frame = buffer->frame;
+    }
+
+    while (buffer->numFences > 0)
+    {
+        StreamBufferFence* fence = &buffer->fences[buffer->firstFence];
+        const GLenum status = glClientWaitSync(fence->glSync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(fence->glSync);
+        buffer->completedFrame = fence->frame;
+        buffer->firstFence = (buffer->firstFence + 1) % STREAM_BUFFER_MAX_FRAMES;
+        buffer->numFences--;
+    }
+
+    buffer->frame++;
+    buffer->bHasReleasesThisFrame = FALSE;
+    reclaim_ranges(buffer);
+}
\ No newline at end of file
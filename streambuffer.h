@@ -0,0 +1,72 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <stddef.h>
+
+#include "gl.h"
+
+// Staging memory for streaming data to the GPU. Ranges are handed out in ring order and may be written
+// from any thread, then copied into their destination buffer on the GL thread. Where the context has
+// buffer storage the ring is one persistently mapped, coherent buffer and the copy stays on the GPU;
+// otherwise it is plain memory and the copy is a glBufferSubData. A released range is only reused once
+// the fence of the frame it was released in has signalled, and the ring only reclaims space in
+// allocation order, so a range held for a long time stalls the ones after it.
+
+#define STREAM_BUFFER_MAX_RANGES 256 // allocated and not yet reclaimed
+#define STREAM_BUFFER_MAX_FRAMES 8 // fenced frames the GPU may fall behind by before stream_buffer_end_frame waits
+
+typedef struct StreamBufferRange {
+    unsigned int id;
+    size_t offset; // in bytes from the start of the ring
+    size_t size;
+    void* data; // where to write the range
+} StreamBufferRange;
+
+typedef struct StreamBufferAllocation {
+    size_t end; // ring position, including any padding skipped before the range
+    unsigned int releaseFrame;
+    int bIsReleased;
+} StreamBufferAllocation;
+
+typedef struct StreamBufferFence {
+    GLsync glSync;
+    unsigned int frame;
+} StreamBufferFence;
+
+typedef struct StreamBuffer {
+    GLuint glBuffer; // 0 when the ring is plain memory
+    unsigned char* data;
+    size_t size;
+    // Positions only ever grow, the ring offset of a position is position % size
+    size_t head;
+    size_t tail;
+    StreamBufferAllocation allocations[STREAM_BUFFER_MAX_RANGES];
+    unsigned int firstAllocation; // id of the oldest range not yet reclaimed
+    int numAllocations;
+    StreamBufferFence fences[STREAM_BUFFER_MAX_FRAMES];
+    int firstFence;
+    int numFences;
+    unsigned int frame;
+    unsigned int completedFrame; // latest frame whose fence has signalled
+    int bHasReleasesThisFrame;
+} StreamBuffer;
+
+void stream_buffer_init(StreamBuffer* out, size_t size);
+
+void stream_buffer_destroy(StreamBuffer* buffer);
+
+// Returns FALSE if the ring has no room until older ranges are released and their frames complete.
+// GL thread only, as are the functions below.
+int stream_buffer_allocate(StreamBuffer* buffer, size_t size, StreamBufferRange* out);
+
+// Copies the range, which must have been written by now, to glDestination at destinationOffset bytes
+void stream_buffer_copy(const StreamBuffer* buffer, const StreamBufferRange* range, GLuint glDestination, size_t destinationOffset);
+
+// Hands the range back once it has been copied, or will never be
+void stream_buffer_release(StreamBuffer* buffer, const StreamBufferRange* range);
+
+// Fences the copies made this frame and reclaims the ranges of frames the GPU has finished. Call once
+// per frame, after the last copy.
+void stream_buffer_end_frame(StreamBuffer* buffer);
+
+#endif
\ No newline at end of file
@@ -1,64 +1,759 @@
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+
+#include "glutils.h"
+#include "logging.h"
+#include "noise.h"
+#include "platform.h"
+#include "profiler.h"
 #include "terrain.h"
 
-void terrain_create_chunk_mesh(TerrainChunk* chunk) 
+MeshVertexAttribute terrainVertexAttributes[3] = {
+    { 3, GL_FLOAT, FALSE, FALSE }, // position
+    { 3, GL_FLOAT, FALSE, FALSE }, // normal
+    { 2, GL_FLOAT, FALSE, FALSE }, // tex coords
+};
+
+MeshVertexAttribute terrainCompactVertexAttributes[2] = {
+    { 1, GL_UNSIGNED_SHORT, FALSE, TRUE }, // height
+    { 2, GL_BYTE, FALSE, TRUE }, // octahedral normal
+};
+
+typedef struct TerrainCompactVertex {
+    unsigned short height;
+    signed char normal[2];
+} TerrainCompactVertex;
+
+TerrainVertexFormat terrain_vertex_format = TERRAIN_VERTEX_FORMAT_FULL;
+
+// Every chunk's vertices and the index sets for each LOD share one arena
+MeshArena terrainArena;
+MeshArenaRange terrainLodIndices[TERRAIN_NUM_LODS][TERRAIN_NUM_STITCH_VARIANTS];
+
+// Chunk coordinates by vertex slot, read by the compact vertex shader as an isamplerBuffer
+GLuint terrainChunkCoordsBuffer;
+GLuint terrainChunkCoordsTexture;
+
+MeshArenaDrawList terrainDrawList;
+
+typedef struct TerrainChunkJob {
+    TerrainGenerator* generator;
+    TerrainChunk* chunk;
+    int x; // copied so workers never read a chunk the main thread may be recycling
+    int z;
+    unsigned int generation;
+    double requestTime;
+    // Vertices are written straight into staging memory when the ring has room, otherwise into data
+    int bIsStaged;
+    StreamBufferRange staging;
+    MeshData data;
+    TerrainChunkMetrics metrics;
+} TerrainChunkJob;
+
+void terrain_sample_height_bounds(float x0, float z0, float size, int resolution, float* minHeight, float* maxHeight)
 {
-    const int size = 16;
+    const int rowSamples = resolution + 1;
+    const float step = size / resolution;
+
+    float heights[rowSamples * rowSamples];
+    float slopesX[rowSamples * rowSamples];
+    float slopesZ[rowSamples * rowSamples];
+    {
+        PROFILE_SCOPE("fractal2d_deriv_grid");
+        fractal2d_deriv_grid(heights, slopesX, slopesZ, rowSamples, rowSamples, x0, z0, step,
+            TERRAIN_NOISE_OCTAVES, TERRAIN_NOISE_FREQUENCY, 1.0f, TERRAIN_NOISE_LACUNARITY, TERRAIN_NOISE_PERSISTENCE);
+    }
+
+    float lo = heights[0];
+    float hi = heights[0];
+    float maxSlope = 0.0f;
+    for (int i = 0; i < rowSamples * rowSamples; ++i)
+    {
+        lo = heights[i] < lo ? heights[i] : lo;
+        hi = heights[i] > hi ? heights[i] : hi;
+        const float slope = sqrtf(slopesX[i] * slopesX[i] + slopesZ[i] * slopesZ[i]);
+        maxSlope = slope > maxSlope ? slope : maxSlope;
+    }
+
+    const float padding = maxSlope * step;
+    *minHeight = (lo - padding) * TERRAIN_HEIGHT_SCALE;
+    *maxHeight = (hi + padding) * TERRAIN_HEIGHT_SCALE;
+}
+
+const int* terrain_get_noise_permutation()
+{
+    return noise_default_context.perm;
+}
+
+void terrain_set_vertex_format(TerrainVertexFormat format)
+{
+    terrain_vertex_format = format;
+}
+
+signed char pack_snorm8(float v)
+{
+    v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+    return (signed char)lroundf(v * 127.0f);
+}
+
+// Projects the unit normal onto the octahedron |x| + |y| + |z| = 1 and unfolds it into a square, with y
+// as the fold axis
+void pack_octahedral_normal(float nx, float ny, float nz, signed char* out)
+{
+    const float l1 = fabsf(nx) + fabsf(ny) + fabsf(nz);
+    float u = nx / l1;
+    float v = nz / l1;
+    if (ny < 0.0f)
+    {
+        const float fu = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        const float fv = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = fu;
+        v = fv;
+    }
+    out[0] = pack_snorm8(u);
+    out[1] = pack_snorm8(v);
+}
+
+// Moves a vertex on a stitched edge that the coarser neighbour doesn't have onto one next to it that it
+// does. Negative edges snap backwards and positive ones forwards, which keeps every remaining triangle
+// wound the same way and leaves none with zero area.
+int stitch_vertex(int vx, int vz, int step, int stitchMask)
+{
+    const int size = TERRAIN_CHUNK_SIZE;
+
+    if (vz == 0 && (stitchMask & TERRAIN_STITCH_NEG_Z))
+        vx -= (vx / step) % 2 ? step : 0;
+    else if (vz == size && (stitchMask & TERRAIN_STITCH_POS_Z))
+        vx += (vx / step) % 2 ? step : 0;
+    else if (vx == 0 && (stitchMask & TERRAIN_STITCH_NEG_X))
+        vz -= (vz / step) % 2 ? step : 0;
+    else if (vx == size && (stitchMask & TERRAIN_STITCH_POS_X))
+        vz += (vz / step) % 2 ? step : 0;
+
+    return vz * (size + 1) + vx;
+}
+
+void terrain_create_gpu_buffers(int maxChunks)
+{
+    const int size = TERRAIN_CHUNK_SIZE;
+    const int maxIndicesPerSet = size * size * 6;
+
+    unsigned int* indices = (unsigned int*)malloc(sizeof(unsigned int) * maxIndicesPerSet * TERRAIN_NUM_LODS * TERRAIN_NUM_STITCH_VARIANTS);
+    unsigned int* iv = indices;
+
+    for (int lod = 0; lod < TERRAIN_NUM_LODS; ++lod)
+        for (int stitchMask = 0; stitchMask < TERRAIN_NUM_STITCH_VARIANTS; ++stitchMask)
+        {
+            // Each LOD skips vertices of the full resolution grid, so chunk vertex data never changes.
+            // The coarsest LOD has no coarser neighbour to stitch to.
+            const int step = 1 << lod;
+            const int mask = lod + 1 < TERRAIN_NUM_LODS ? stitchMask : 0;
+
+            terrainLodIndices[lod][stitchMask].offset = (unsigned int)(iv - indices);
+            for (int vz = 0; vz < size; vz += step)
+                for (int vx = 0; vx < size; vx += step)
+                {
+                    int v0 = stitch_vertex(vx, vz, step, mask);
+                    int v1 = stitch_vertex(vx + step, vz, step, mask);
+                    int v2 = stitch_vertex(vx, vz + step, step, mask);
+                    int v3 = stitch_vertex(vx + step, vz + step, step, mask);
+
+                    // Stitching collapses one triangle of each cell along the edge, and both of a corner cell
+                    // stitched on two sides
+                    if (v0 != v1 && v0 != v2 && v1 != v2)
+                    {
+                        *iv++ = v0;
+                        *iv++ = v2;
+                        *iv++ = v1;
+                    }
+                    if (v1 != v2 && v1 != v3 && v2 != v3)
+                    {
+                        *iv++ = v1;
+                        *iv++ = v2;
+                        *iv++ = v3;
+                    }
+                }
+            terrainLodIndices[lod][stitchMask].count = (unsigned int)(iv - indices) - terrainLodIndices[lod][stitchMask].offset;
+        }
+
+    const unsigned int numIndices = (unsigned int)(iv - indices);
+    const int rowVertices = size + 1;
+    if (terrain_vertex_format == TERRAIN_VERTEX_FORMAT_COMPACT)
+        mesh_arena_init(&terrainArena, terrainCompactVertexAttributes, 2, maxChunks * rowVertices * rowVertices, numIndices);
+    else
+        mesh_arena_init(&terrainArena, terrainVertexAttributes, 3, maxChunks * rowVertices * rowVertices, numIndices);
+
+    // The sets were laid out back to back from 0, which is where the empty arena hands out one range
+    // covering all of them
+    MeshArenaRange all;
+    mesh_arena_allocate_indices(&terrainArena, numIndices, &all);
+    mesh_arena_upload_indices(&terrainArena, &all, indices);
+
+    free(indices);
+
+    gut_create_buffer(&terrainChunkCoordsBuffer, GL_TEXTURE_BUFFER, sizeof(int) * 2 * maxChunks, NULL, GL_DYNAMIC_DRAW);
+    glGenTextures(1, &terrainChunkCoordsTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, terrainChunkCoordsTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32I, terrainChunkCoordsBuffer);
+
+    mesh_arena_draw_list_init(&terrainDrawList, maxChunks);
+}
+
+void terrain_destroy_gpu_buffers()
+{
+    mesh_arena_destroy(&terrainArena);
+    glDeleteTextures(1, &terrainChunkCoordsTexture);
+    glDeleteBuffers(1, &terrainChunkCoordsBuffer);
+    mesh_arena_draw_list_destroy(&terrainDrawList);
+}
+
+// Worst vertical distance between the full resolution heights and the surface drawn at each LOD, which
+// interpolates them across the same two triangles per cell as the index buffers
+void calculate_lod_errors(const float* heights, float* lodErrors)
+{
+    const int size = TERRAIN_CHUNK_SIZE;
+    const int rowVertices = size + 1;
+
+    lodErrors[0] = 0.0f;
+    for (int lod = 1; lod < TERRAIN_NUM_LODS; ++lod)
+    {
+        const int step = 1 << lod;
+
+        // Coarser LODs never get to look better than finer ones
+        float error = lodErrors[lod - 1];
+        for (int vz = 0; vz <= size; ++vz)
+            for (int vx = 0; vx <= size; ++vx)
+            {
+                const int cx = vx == size ? size - step : vx - vx % step;
+                const int cz = vz == size ? size - step : vz - vz % step;
+                const float u = (float)(vx - cx) / step;
+                const float w = (float)(vz - cz) / step;
+
+                const float h0 = heights[cz * rowVertices + cx];
+                const float h1 = heights[cz * rowVertices + cx + step];
+                const float h2 = heights[(cz + step) * rowVertices + cx];
+                const float h3 = heights[(cz + step) * rowVertices + cx + step];
+                const float h = u + w <= 1.0f
+                    ? h0 + u * (h1 - h0) + w * (h2 - h0)
+                    : h3 + (1.0f - u) * (h2 - h3) + (1.0f - w) * (h1 - h3);
+
+                const float e = fabsf(h - heights[vz * rowVertices + vx]) * TERRAIN_HEIGHT_SCALE;
+                if (e > error)
+                    error = e;
+            }
+
+        lodErrors[lod] = error;
+    }
+}
+
+// Lowest vertex a LOD's triangles over the block can interpolate: those on the LOD's grid within the
+// block, widened to whole cells of the LOD where they are bigger than the block
+float get_lowest_lod_vertex(const float* heights, int lod, int bx, int bz)
+{
+    const int rowVertices = TERRAIN_CHUNK_SIZE + 1;
+    const int blockSize = TERRAIN_CHUNK_SIZE / TERRAIN_OCCLUDER_RESOLUTION;
+    const int step = 1 << lod;
+
+    const int x0 = bx * blockSize / step * step;
+    const int z0 = bz * blockSize / step * step;
+    const int x1 = ((bx + 1) * blockSize + step - 1) / step * step;
+    const int z1 = ((bz + 1) * blockSize + step - 1) / step * step;
+
+    float lowest = heights[z0 * rowVertices + x0];
+    for (int vz = z0; vz <= z1; vz += step)
+        for (int vx = x0; vx <= x1; vx += step)
+            lowest = fminf(lowest, heights[vz * rowVertices + vx]);
+    return lowest;
+}
+
+// Terrace heights for each LOD. Stitched edges also use the next LOD's vertices, and quantisation can
+// move any height down by a step.
+void calculate_occluder_heights(const float* heights, TerrainChunkMetrics* metrics)
+{
+    const float quantisationStep = (TERRAIN_HEIGHT_MAX - TERRAIN_HEIGHT_MIN) / 65535.0f;
+
+    for (int b = 0; b < TERRAIN_OCCLUDER_RESOLUTION * TERRAIN_OCCLUDER_RESOLUTION; ++b)
+    {
+        float lowest[TERRAIN_NUM_LODS];
+        for (int lod = 0; lod < TERRAIN_NUM_LODS; ++lod)
+            lowest[lod] = get_lowest_lod_vertex(heights, lod, b % TERRAIN_OCCLUDER_RESOLUTION, b / TERRAIN_OCCLUDER_RESOLUTION);
+
+        for (int lod = 0; lod < TERRAIN_NUM_LODS; ++lod)
+        {
+            const int next = lod + 1 < TERRAIN_NUM_LODS ? lod + 1 : lod;
+            metrics->occluderHeights[lod][b] = fminf(lowest[lod], lowest[next]) * TERRAIN_HEIGHT_SCALE - quantisationStep;
+        }
+    }
+}
+
+size_t terrain_get_chunk_vertices_size()
+{
+    const int numVertices = (TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1);
+    if (terrain_vertex_format == TERRAIN_VERTEX_FORMAT_COMPACT)
+        return sizeof(TerrainCompactVertex) * numVertices;
+    return sizeof(float) * 8 * numVertices;
+}
+
+void terrain_generate_chunk_vertices(int chunkX, int chunkZ, void* outVertices, TerrainChunkMetrics* outMetrics)
+{
+    PROFILE_SCOPE("terrain_generate_chunk_vertices");
+    const int size = TERRAIN_CHUNK_SIZE;
+    const int rowVertices = size + 1;
+    const int numVertices = rowVertices * rowVertices;
+
+    const float originX = (float)(chunkX * size);
+    const float originZ = (float)(chunkZ * size);
+
+    // Heights and their slopes in one pass, so normals cost no extra noise evaluations
+    float heights[(TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1)];
+    float slopesX[(TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1)];
+    float slopesZ[(TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1)];
+    {
+        PROFILE_SCOPE("fractal2d_deriv_grid");
+        fractal2d_deriv_grid(heights, slopesX, slopesZ, rowVertices, rowVertices, originX, originZ, 1.0f,
+            TERRAIN_NOISE_OCTAVES, TERRAIN_NOISE_FREQUENCY, 1.0f, TERRAIN_NOISE_LACUNARITY, TERRAIN_NOISE_PERSISTENCE);
+    }
+
+    if (outMetrics)
+    {
+        outMetrics->minHeight = outMetrics->maxHeight = heights[0];
+        for (int v = 1; v < numVertices; ++v)
+        {
+            outMetrics->minHeight = heights[v] < outMetrics->minHeight ? heights[v] : outMetrics->minHeight;
+            outMetrics->maxHeight = heights[v] > outMetrics->maxHeight ? heights[v] : outMetrics->maxHeight;
+        }
+        outMetrics->minHeight *= TERRAIN_HEIGHT_SCALE;
+        outMetrics->maxHeight *= TERRAIN_HEIGHT_SCALE;
+
+        calculate_lod_errors(heights, outMetrics->lodErrors);
+        calculate_occluder_heights(heights, outMetrics);
+    }
+
+    if (terrain_vertex_format == TERRAIN_VERTEX_FORMAT_COMPACT)
+    {
+        const float heightScale = 65535.0f / (TERRAIN_HEIGHT_MAX - TERRAIN_HEIGHT_MIN);
+
+        TerrainCompactVertex* cv = (TerrainCompactVertex*)outVertices;
+        for (int v = 0; v < numVertices; ++v)
+        {
+            const float nx = -slopesX[v] * TERRAIN_HEIGHT_SCALE;
+            const float nz = -slopesZ[v] * TERRAIN_HEIGHT_SCALE;
+            const float nlen = sqrtf(nx * nx + 1.0f + nz * nz);
+
+            const float height = heights[v] * TERRAIN_HEIGHT_SCALE;
+            const float quantised = (height - TERRAIN_HEIGHT_MIN) * heightScale;
+            cv[v].height = (unsigned short)lroundf(quantised < 0.0f ? 0.0f : (quantised > 65535.0f ? 65535.0f : quantised));
+            pack_octahedral_normal(nx / nlen, 1.0f / nlen, nz / nlen, cv[v].normal);
+        }
+    }
+    else
+    {
+        float* vv = (float*)outVertices;
+        for (int vz = 0; vz < rowVertices; ++vz)
+            for (int vx = 0; vx < rowVertices; ++vx)
+            {
+                const int v = vz * rowVertices + vx;
 
+                // The surface is y = h(x, z), so its normal is (-dh/dx, 1, -dh/dz) normalised
+                const float nx = -slopesX[v] * TERRAIN_HEIGHT_SCALE;
+                const float nz = -slopesZ[v] * TERRAIN_HEIGHT_SCALE;
+                const float nlen = sqrtf(nx * nx + 1.0f + nz * nz);
+
+                *vv++ = originX + (float)vx;
+                *vv++ = heights[v] * TERRAIN_HEIGHT_SCALE;
+                *vv++ = originZ + (float)vz;
+                *vv++ = nx / nlen;
+                *vv++ = 1.0f / nlen;
+                *vv++ = nz / nlen;
+                *vv++ = (float)vx / size;
+                *vv++ = (float)vz / size;
+            }
+    }
+}
+
+void terrain_generate_chunk_data(int chunkX, int chunkZ, MeshData* out, TerrainChunkMetrics* outMetrics)
+{
+    if (terrain_vertex_format == TERRAIN_VERTEX_FORMAT_COMPACT)
+    {
+        out->vertexAttributes = terrainCompactVertexAttributes;
+        out->numVertexAttributes = 2;
+    }
+    else
+    {
+        out->vertexAttributes = terrainVertexAttributes;
+        out->numVertexAttributes = 3;
+    }
+    out->numVertices = (TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1);
+    out->numIndices = 0;
+    mesh_allocate_mesh_data(out);
+
+    terrain_generate_chunk_vertices(chunkX, chunkZ, out->vertices, outMetrics);
+}
+
+// Allocates the chunk's vertex range if it has none yet and records its coordinates for the shader.
+// Returns FALSE if the arena is full or the range is not in a chunk slot.
+int prepare_chunk_vertices(TerrainChunk* chunk)
+{
+    const unsigned int numVertices = (TERRAIN_CHUNK_SIZE + 1) * (TERRAIN_CHUNK_SIZE + 1);
+    if (!chunk->vertices.count && !mesh_arena_allocate_vertices(&terrainArena, numVertices, &chunk->vertices))
+    {
+        LOG("Terrain arena is full, chunk (%d, %d) not uploaded.", chunk->x, chunk->z);
+        return FALSE;
+    }
+
+    // The shader looks the coordinates up at gl_VertexID / numVertices, which is only this chunk's
+    // slot while every range in the arena is one chunk long and first fit keeps them aligned to it
+    if (chunk->vertices.count != numVertices || chunk->vertices.offset % numVertices != 0)
+    {
+        LOG("Chunk (%d, %d) vertex range at %u is not a chunk slot, chunk not uploaded.", chunk->x, chunk->z, chunk->vertices.offset);
+        mesh_arena_free_vertices(&terrainArena, &chunk->vertices);
+        chunk->vertices.count = 0;
+        return FALSE;
+    }
+
+    const int coords[2] = { chunk->x, chunk->z };
+    const unsigned int slot = chunk->vertices.offset / numVertices;
+    glBindBuffer(GL_TEXTURE_BUFFER, terrainChunkCoordsBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)(sizeof(coords) * slot), sizeof(coords), coords);
+    return TRUE;
+}
+
+void terrain_upload_chunk_mesh(TerrainChunk* chunk, MeshData* data)
+{
+    if (prepare_chunk_vertices(chunk))
+    {
+        mesh_arena_upload_vertices(&terrainArena, &chunk->vertices, data->vertices);
+        chunk->bIsMeshReady = TRUE;
+    }
+
+    mesh_free_mesh_data(data);
+}
+
+void terrain_create_chunk_mesh(TerrainChunk* chunk) 
+{
+    PROFILE_SCOPE("terrain_create_chunk_mesh");
     MeshData data;
+    terrain_generate_chunk_data(chunk->x, chunk->z, &data, &chunk->metrics);
+    terrain_upload_chunk_mesh(chunk, &data);
+}
+
+void terrain_set_chunk_lod(TerrainChunk* chunk, int lod, int stitchMask)
+{
+    if (chunk->lod == lod && chunk->stitchMask == stitchMask)
+        return;
+
+    chunk->lod = lod;
+    chunk->stitchMask = stitchMask;
+}
+
+void terrain_queue_chunk_draw(const TerrainChunk* chunk)
+{
+    mesh_arena_draw_list_add(&terrainDrawList, &terrainLodIndices[chunk->lod][chunk->stitchMask], &chunk->vertices);
+}
+
+void terrain_draw_queued_chunks()
+{
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, terrainChunkCoordsTexture);
+    mesh_arena_bind(&terrainArena);
+    mesh_arena_draw_list_submit(&terrainDrawList);
+}
+
+void terrain_rasterise_chunk_occluder(const TerrainChunk* chunk, OcclusionBuffer* buffer)
+{
+    const int res = TERRAIN_OCCLUDER_RESOLUTION;
+    const float blockSize = (float)TERRAIN_CHUNK_SIZE / res;
+    const float* heights = chunk->metrics.occluderHeights[chunk->lod];
+
+    for (int bz = 0; bz < res; ++bz)
+        for (int bx = 0; bx < res; ++bx)
+        {
+            const float x0 = chunk->x * TERRAIN_CHUNK_SIZE + bx * blockSize;
+            const float z0 = chunk->z * TERRAIN_CHUNK_SIZE + bz * blockSize;
+            const float x1 = x0 + blockSize;
+            const float z1 = z0 + blockSize;
+            const float h = heights[bz * res + bx];
+
+            const float top[12] = { x0, h, z1, x1, h, z1, x1, h, z0, x0, h, z0 };
+            occlusion_rasterise_quad(buffer, top);
+
+            // Everything under a terrace is under the surface too, so each block is a solid column. Only
+            // the faces not buried in a neighbouring column are drawn: the step up from a lower block
+            // inside the chunk, and the full height along the chunk's edges so neighbouring chunks seal.
+            const float below[4] = {
+                bx > 0 ? heights[bz * res + bx - 1] : TERRAIN_HEIGHT_MIN,
+                bx + 1 < res ? heights[bz * res + bx + 1] : TERRAIN_HEIGHT_MIN,
+                bz > 0 ? heights[(bz - 1) * res + bx] : TERRAIN_HEIGHT_MIN,
+                bz + 1 < res ? heights[(bz + 1) * res + bx] : TERRAIN_HEIGHT_MIN,
+            };
+            // Bottom edge of each side, ordered so the wall winds counter-clockwise seen from outside
+            const float sides[4][4] = { { x0, z0, x0, z1 }, { x1, z1, x1, z0 }, { x1, z0, x0, z0 }, { x0, z1, x1, z1 } };
+            for (int side = 0; side < 4; ++side)
+                if (below[side] < h)
+                {
+                    const float* e = sides[side];
+                    const float wall[12] = { e[0], below[side], e[1], e[2], below[side], e[3], e[2], h, e[3], e[0], h, e[1] };
+                    occlusion_rasterise_quad(buffer, wall);
+                }
+        }
+}
+
+void terrain_generator_init(TerrainGenerator* out, int numThreads)
+{
+    // Pick the noise kernel up front instead of letting the first workers race to do it
+    noise_get_batch_kernel();
+
+    stream_buffer_init(&out->staging, terrain_get_chunk_vertices_size() * TERRAIN_STAGING_CHUNKS);
+    jobs_completion_queue_init(&out->completed, 1024);
+    jobs_init(&out->jobs, numThreads);
+}
+
+void terrain_generator_destroy(TerrainGenerator* generator)
+{
+    jobs_destroy(&generator->jobs);
+
+    TerrainChunkJob* job;
+    while ((job = (TerrainChunkJob*)jobs_completion_queue_pop(&generator->completed)))
+    {
+        mesh_free_mesh_data(&job->data);
+        free(job);
+    }
+
+    jobs_completion_queue_destroy(&generator->completed);
+    stream_buffer_destroy(&generator->staging);
+}
+
+void terrain_chunk_job(void* userData)
+{
+    PROFILE_SCOPE("terrain_chunk_job");
+    TerrainChunkJob* job = (TerrainChunkJob*)userData;
+
+    // Skip chunks that scrolled out of range while queued, this is what keeps the backlog short when
+    // the camera moves fast
+    if (atomic_load(&job->chunk->generation) == job->generation)
+    {
+        if (job->bIsStaged)
+            terrain_generate_chunk_vertices(job->x, job->z, job->staging.data, &job->metrics);
+        else
+            terrain_generate_chunk_data(job->x, job->z, &job->data, &job->metrics);
+    }
+
+    // The queue only fills up if the main thread stops uploading; wait for it rather than drop work
+    while (!jobs_completion_queue_push(&job->generator->completed, job))
+        sched_yield();
+}
+
+void terrain_generator_request(TerrainGenerator* generator, TerrainChunk* chunk)
+{
+    TerrainChunkJob* job = (TerrainChunkJob*)malloc(sizeof(TerrainChunkJob));
+    job->generator = generator;
+    job->chunk = chunk;
+    job->x = chunk->x;
+    job->z = chunk->z;
+    job->generation = atomic_fetch_add(&chunk->generation, 1) + 1;
+    job->requestTime = platform_get_time();
+    job->bIsStaged = stream_buffer_allocate(&generator->staging, terrain_get_chunk_vertices_size(), &job->staging);
+    job->data.vertices = NULL;
+    job->data.indices = NULL;
+    chunk->bIsMeshReady = FALSE;
+    jobs_submit(&generator->jobs, terrain_chunk_job, job);
+}
+
+int terrain_generator_upload_one(TerrainGenerator* generator, double* outLatency)
+{
+    PROFILE_SCOPE("terrain_generator_upload_one");
+    if (outLatency)
+        *outLatency = -1.0;
+
+    TerrainChunkJob* job = (TerrainChunkJob*)jobs_completion_queue_pop(&generator->completed);
+    if (!job)
+        return FALSE;
+
+    TerrainChunk* chunk = job->chunk;
+    if (atomic_load(&chunk->generation) != job->generation)
+        mesh_free_mesh_data(&job->data);
+    else if (!job->bIsStaged)
+    {
+        chunk->metrics = job->metrics;
+        terrain_upload_chunk_mesh(chunk, &job->data);
+    }
+    else if (prepare_chunk_vertices(chunk))
+    {
+        chunk->metrics = job->metrics;
+        stream_buffer_copy(&generator->staging, &job->staging, terrainArena.glVbo, terrainArena.vertexSize * chunk->vertices.offset);
+        chunk->bIsMeshReady = TRUE;
+    }
+
+    if (job->bIsStaged)
+        stream_buffer_release(&generator->staging, &job->staging);
+
+    if (outLatency && chunk->bIsMeshReady && atomic_load(&chunk->generation) == job->generation)
+        *outLatency = platform_get_time() - job->requestTime;
+
+    free(job);
+    return TRUE;
+}
+
+void terrain_generator_end_frame(TerrainGenerator* generator)
+{
+    stream_buffer_end_frame(&generator->staging);
+}
+
+int wrap_chunk_coord(int c, int size)
+{
+    return ((c % size) + size) % size;
+}
+
+void terrain_chunk_grid_init(TerrainChunkGrid* out, int radius)
+{
+    out->radius = radius;
+    out->size = 2 * radius + 1;
+    out->centreX = INT_MIN;
+    out->centreZ = INT_MIN;
+    out->chunks = (TerrainChunk*)malloc(sizeof(TerrainChunk) * out->size * out->size);
+    out->boundsMinX = (float*)malloc(sizeof(float) * out->size * out->size * 6);
+    out->boundsMinY = out->boundsMinX + out->size * out->size;
+    out->boundsMinZ = out->boundsMinY + out->size * out->size;
+    out->boundsMaxX = out->boundsMinZ + out->size * out->size;
+    out->boundsMaxY = out->boundsMaxX + out->size * out->size;
+    out->boundsMaxZ = out->boundsMaxY + out->size * out->size;
 
-    MeshVertexAttribute vertexAttributes[1];
-    vertexAttributes[0].count = 3;
-    vertexAttributes[0].glType = GL_FLOAT;
-    vertexAttributes[0].bIntegerStorage = FALSE;
-    vertexAttributes[0].bNormalised = FALSE;
-    
-    data.vertexAttributes = vertexAttributes;
-    data.numVertexAttributes = 1;
-    data.numVertices = (size + 1) * (size + 1);
-    data.numIndices = size * size * 6;
-    mesh_allocate_mesh_data(&data);
-
-    for (int vx = 0; vx < size; ++vx)
-        for (int vy = 0; vy < size; ++vy)
+    for (int i = 0; i < out->size * out->size; ++i)
+    {
+        // No real chunk maps to INT_MIN, so the first update requests every slot
+        out->chunks[i].x = INT_MIN;
+        out->chunks[i].z = INT_MIN;
+        out->chunks[i].lod = 0;
+        out->chunks[i].stitchMask = 0;
+        out->chunks[i].bIsMeshReady = FALSE;
+        out->chunks[i].metrics.minHeight = 0.0f;
+        out->chunks[i].metrics.maxHeight = 0.0f;
+        atomic_init(&out->chunks[i].generation, 0);
+        out->chunks[i].vertices.offset = 0;
+        out->chunks[i].vertices.count = 0;
+    }
+}
+
+void terrain_chunk_grid_destroy(TerrainChunkGrid* grid)
+{
+    for (int i = 0; i < grid->size * grid->size; ++i)
+        mesh_arena_free_vertices(&terrainArena, &grid->chunks[i].vertices);
+
+    free(grid->chunks);
+    free(grid->boundsMinX);
+    grid->chunks = NULL;
+}
+
+void terrain_chunk_grid_update(TerrainChunkGrid* grid, TerrainGenerator* generator, float worldX, float worldZ)
+{
+    const int centreX = (int)floorf(worldX / TERRAIN_CHUNK_SIZE);
+    const int centreZ = (int)floorf(worldZ / TERRAIN_CHUNK_SIZE);
+    if (centreX == grid->centreX && centreZ == grid->centreZ)
+        return;
+
+    grid->centreX = centreX;
+    grid->centreZ = centreZ;
+
+    // Every coordinate in the window owns exactly one slot; only slots still holding a chunk from
+    // outside the window are reassigned
+    for (int z = centreZ - grid->radius; z <= centreZ + grid->radius; ++z)
+        for (int x = centreX - grid->radius; x <= centreX + grid->radius; ++x)
         {
-            float vposx = (float)vx - 0.5f;
-            float vposy = 0.0f;
-            float vposz = (float)vx - 0.5f;
-            float vnorx = 0.0f;
-            float vnory = 1.0f;
-            float vnorz = 0.0f;
-            float vtexu = 0.0f;
-            float vtexv = 0.0f;
-
-            float* vv = data.vertices + (size * vx + vy) * 3;
-            *vv = vposx;
-            *vv++ = vposy;
-            *vv++ = vposz;
-            *vv++ = vnorx;
-            *vv++ = vnory;
-            *vv++ = vnorz;
-            *vv++ = vtexu;
-            *vv = vtexv;
+            TerrainChunk* chunk = &grid->chunks[wrap_chunk_coord(z, grid->size) * grid->size + wrap_chunk_coord(x, grid->size)];
+            if (chunk->x == x && chunk->z == z)
+                continue;
+
+            chunk->x = x;
+            chunk->z = z;
+            terrain_generator_request(generator, chunk);
         }
+}
+
+void terrain_chunk_grid_update_bounds(TerrainChunkGrid* grid)
+{
+    for (int i = 0; i < grid->size * grid->size; ++i)
+    {
+        const TerrainChunk* chunk = &grid->chunks[i];
+        grid->boundsMinX[i] = (float)(chunk->x * TERRAIN_CHUNK_SIZE);
+        grid->boundsMinY[i] = chunk->metrics.minHeight;
+        grid->boundsMinZ[i] = (float)(chunk->z * TERRAIN_CHUNK_SIZE);
+        grid->boundsMaxX[i] = (float)((chunk->x + 1) * TERRAIN_CHUNK_SIZE);
+        grid->boundsMaxY[i] = chunk->metrics.maxHeight;
+        grid->boundsMaxZ[i] = (float)((chunk->z + 1) * TERRAIN_CHUNK_SIZE);
+    }
+}
+
+void terrain_chunk_grid_select_lods(TerrainChunkGrid* grid, float cameraX, float cameraY, float cameraZ, float errorScale)
+{
+    const int size = grid->size;
 
-    for (int vx = 0; vx < size; ++vx)
-        for (int vy = 0; vy < size; ++vy)
+    // Window-relative LODs, so neighbours can be looked up without wrapping
+    int lods[size * size];
+    for (int gz = 0; gz < size; ++gz)
+        for (int gx = 0; gx < size; ++gx)
         {
-            int v0 = vx * size + vy;
-            int v1 = v0 + 1;
-            int v2 = v0 + size;
-            int v3 = v2 + 1;
-
-            unsigned int* iv = data.indices + (size * vx + vy) * 6;
-            *iv = v0;
-            *iv++ = v1;
-            *iv++ = v2;
-            *iv++ = v2;
-            *iv++ = v1;
-            *iv++ = v3;
+            const int x = grid->centreX - grid->radius + gx;
+            const int z = grid->centreZ - grid->radius + gz;
+            const TerrainChunk* chunk = &grid->chunks[wrap_chunk_coord(z, size) * size + wrap_chunk_coord(x, size)];
+
+            // Distance to the closest point of the chunk's bounds
+            const float minX = (float)(x * TERRAIN_CHUNK_SIZE);
+            const float minZ = (float)(z * TERRAIN_CHUNK_SIZE);
+            const float dx = fmaxf(fmaxf(minX - cameraX, cameraX - minX - TERRAIN_CHUNK_SIZE), 0.0f);
+            const float dz = fmaxf(fmaxf(minZ - cameraZ, cameraZ - minZ - TERRAIN_CHUNK_SIZE), 0.0f);
+            const float dy = chunk->bIsMeshReady ? fmaxf(fmaxf(chunk->metrics.minHeight - cameraY, cameraY - chunk->metrics.maxHeight), 0.0f) : 0.0f;
+            const float distance = fmaxf(sqrtf(dx * dx + dy * dy + dz * dz), 1.0f);
+
+            int lod = 0;
+            if (chunk->bIsMeshReady)
+                while (lod + 1 < TERRAIN_NUM_LODS && chunk->metrics.lodErrors[lod + 1] * errorScale <= distance)
+                    ++lod;
+            lods[gz * size + gx] = lod;
         }
 
-    mesh_create(&chunk->mesh, &data);
+    // Coarsen any chunk more than one LOD finer than a neighbour until none are, so every seam can be
+    // stitched. Each pass only ever raises LODs, so this settles within TERRAIN_NUM_LODS passes.
+    int bChanged = TRUE;
+    while (bChanged)
+    {
+        bChanged = FALSE;
+        for (int gz = 0; gz < size; ++gz)
+            for (int gx = 0; gx < size; ++gx)
+            {
+                int* lod = &lods[gz * size + gx];
+                const int neighbours[4] = {
+                    gx > 0 ? lods[gz * size + gx - 1] : 0,
+                    gx < size - 1 ? lods[gz * size + gx + 1] : 0,
+                    gz > 0 ? lods[(gz - 1) * size + gx] : 0,
+                    gz < size - 1 ? lods[(gz + 1) * size + gx] : 0,
+                };
+                for (int n = 0; n < 4; ++n)
+                    if (neighbours[n] - 1 > *lod)
+                    {
+                        *lod = neighbours[n] - 1;
+                        bChanged = TRUE;
+                    }
+            }
+    }
 
-    mesh_free_mesh_data(&data);
+    for (int gz = 0; gz < size; ++gz)
+        for (int gx = 0; gx < size; ++gx)
+        {
+            const int lod = lods[gz * size + gx];
+
+            int stitchMask = 0;
+            if (gx > 0 && lods[gz * size + gx - 1] > lod)
+                stitchMask |= TERRAIN_STITCH_NEG_X;
+            if (gx < size - 1 && lods[gz * size + gx + 1] > lod)
+                stitchMask |= TERRAIN_STITCH_POS_X;
+            if (gz > 0 && lods[(gz - 1) * size + gx] > lod)
+                stitchMask |= TERRAIN_STITCH_NEG_Z;
+            if (gz < size - 1 && lods[(gz + 1) * size + gx] > lod)
+                stitchMask |= TERRAIN_STITCH_POS_Z;
+
+            const int x = grid->centreX - grid->radius + gx;
+            const int z = grid->centreZ - grid->radius + gz;
+            terrain_set_chunk_lod(&grid->chunks[wrap_chunk_coord(z, size) * size + wrap_chunk_coord(x, size)], lod, stitchMask);
+        }
 }
\ No newline at end of file
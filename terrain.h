@@ -1,13 +1,180 @@
 #ifndef TERRAIN_H
 #define TERRAIN_H
 
+#include "jobs.h"
 #include "macromagic.h"
 #include "mesh.h"
+#include "occlusion.h"
+#include "streambuffer.h"
+
+#define TERRAIN_CHUNK_SIZE 16
+#define TERRAIN_NUM_LODS 5 // log2(TERRAIN_CHUNK_SIZE) + 1, LOD n samples every 2^n vertices
+
+// Edges of a chunk whose neighbour is one LOD coarser. Those edges skip every other vertex to match the
+// neighbour, so each LOD has an index buffer for every combination of the four bits.
+#define TERRAIN_STITCH_NEG_X 1
+#define TERRAIN_STITCH_POS_X 2
+#define TERRAIN_STITCH_NEG_Z 4
+#define TERRAIN_STITCH_POS_Z 8
+#define TERRAIN_NUM_STITCH_VARIANTS 16
+#define TERRAIN_HEIGHT_SCALE 8.0f
+
+// Chunks occlude as terraces: blocks of TERRAIN_CHUNK_SIZE / TERRAIN_OCCLUDER_RESOLUTION cells, each a
+// solid column up to the lowest height the chunk's LOD draws over it, so all of it lies under the drawn
+// surface
+#define TERRAIN_OCCLUDER_RESOLUTION 8
+
+// Chunks whose vertices can be in flight through the staging ring at once. Requests beyond this
+// generate into their own allocation and upload with glBufferSubData.
+#define TERRAIN_STAGING_CHUNKS 128
+
+// Compact vertices quantise heights to this range, which the fractal sum never leaves
+#define TERRAIN_HEIGHT_MIN (-2.0f * TERRAIN_HEIGHT_SCALE)
+#define TERRAIN_HEIGHT_MAX (2.0f * TERRAIN_HEIGHT_SCALE)
+
+#define TERRAIN_NOISE_OCTAVES 6
+#define TERRAIN_NOISE_FREQUENCY 0.02f
+#define TERRAIN_NOISE_LACUNARITY 2.0f
+#define TERRAIN_NOISE_PERSISTENCE 0.5f
+
+typedef enum TerrainVertexFormat {
+    // Position, normal and tex coords as floats, 32 bytes
+    TERRAIN_VERTEX_FORMAT_FULL,
+    // Normalised 16 bit height plus an octahedral normal in two normalised bytes, 4 bytes. Every chunk
+    // takes (TERRAIN_CHUNK_SIZE + 1)^2 vertices of the arena, so gl_VertexID divides into a slot, which
+    // indexes the chunk coordinates bound for terrain_draw_queued_chunks, and a vertex within the chunk
+    // (row-major), from which the shader rebuilds x/z and tex coords.
+    TERRAIN_VERTEX_FORMAT_COMPACT,
+} TerrainVertexFormat;
+
+extern TerrainVertexFormat terrain_vertex_format;
+
+// What the CPU learns about a chunk while generating it, in world units
+typedef struct TerrainChunkMetrics {
+    float minHeight;
+    float maxHeight;
+    float lodErrors[TERRAIN_NUM_LODS]; // worst vertical error of drawing at each LOD
+    float occluderHeights[TERRAIN_NUM_LODS][TERRAIN_OCCLUDER_RESOLUTION * TERRAIN_OCCLUDER_RESOLUTION]; // row-major terraces per LOD
+} TerrainChunkMetrics;
 
 typedef struct TerrainChunk {
-    Mesh mesh;
+    int x;
+    int z;
+    int lod;
+    int stitchMask; // TERRAIN_STITCH_* bits
+    int bIsMeshReady;
+    atomic_uint generation; // bumped on every request so stale results can be dropped
+    TerrainChunkMetrics metrics;
+    MeshArenaRange vertices; // empty until the first upload, after which the range is reused
 } TerrainChunk;
 
+// Generates chunks on worker threads and hands the finished MeshData back to the main thread, which
+// does the GL upload
+typedef struct TerrainGenerator {
+    JobSystem jobs;
+    JobCompletionQueue completed;
+    StreamBuffer staging; // workers write vertices here, the main thread copies them into the arena
+} TerrainGenerator;
+
+// Fixed window of chunks centred on the camera. Slots are indexed by chunk coordinate modulo the
+// window size, so when the centre moves only the newly exposed row or column is regenerated and the
+// chunks that fell out of range are recycled into it.
+typedef struct TerrainChunkGrid {
+    int radius;
+    int size; // 2 * radius + 1
+    int centreX;
+    int centreZ;
+    TerrainChunk* chunks; // size * size
+    // World bounds of each chunk, one array per component and indexed like chunks, for batch culling
+    float* boundsMinX;
+    float* boundsMinY;
+    float* boundsMinZ;
+    float* boundsMaxX;
+    float* boundsMaxY;
+    float* boundsMaxZ;
+} TerrainChunkGrid;
+
+// Height bounds of the terrain over the square [x0, x0 + size] x [z0, z0 + size], from heights sampled on
+// a (resolution + 1)^2 grid and padded by the steepest slope found times the sample spacing, so they also
+// hold between samples. Safe to call from any thread.
+void terrain_sample_height_bounds(float x0, float z0, float size, int resolution, float* minHeight, float* maxHeight);
+
+// The 512 entry (doubled) permutation table terrain heights are generated with, for renderers that
+// evaluate the same noise on the GPU
+const int* terrain_get_noise_permutation();
+
+// Chunk meshes are recycled in place, so set this before the first chunk is generated
+void terrain_set_vertex_format(TerrainVertexFormat format);
+
+// All chunk meshes live in one arena, with room for maxChunks. The index sets depend only on grid
+// resolution, so every chunk shares one per LOD and stitch variant from the same arena. Create it once
+// on the GL thread, after choosing the vertex format and before any chunk mesh is uploaded.
+void terrain_create_gpu_buffers(int maxChunks);
+
+void terrain_destroy_gpu_buffers();
+
+// Bytes of vertex data per chunk in the current vertex format
+size_t terrain_get_chunk_vertices_size();
+
+// CPU half of chunk creation (heights and normals), into terrain_get_chunk_vertices_size() bytes at
+// outVertices. Safe to call from any thread. outMetrics may be NULL.
+void terrain_generate_chunk_vertices(int chunkX, int chunkZ, void* outVertices, TerrainChunkMetrics* outMetrics);
+
+// As terrain_generate_chunk_vertices, into newly allocated MeshData
+void terrain_generate_chunk_data(int chunkX, int chunkZ, MeshData* out, TerrainChunkMetrics* outMetrics);
+
+// Uploads data to the chunk's vertex range, allocating it on first use, and frees it. Must be called on
+// the GL thread.
+void terrain_upload_chunk_mesh(TerrainChunk* chunk, MeshData* data);
+
+// Generates and uploads the chunk on the calling thread, which must be the GL thread. The streamed grid
+// goes through TerrainGenerator instead; this is for one-off chunks and debugging.
 void terrain_create_chunk_mesh(TerrainChunk* chunk);
 
+// Selects the index set the chunk draws with
+void terrain_set_chunk_lod(TerrainChunk* chunk, int lod, int stitchMask);
+
+// Chunks are drawn in one batch: queue every visible chunk, then draw them all with one multi-draw call
+void terrain_queue_chunk_draw(const TerrainChunk* chunk);
+
+// Draws and empties the queue. The chunk coordinates the compact format's shader needs are bound to
+// texture unit 0 as an RG32I buffer texture, indexed by gl_VertexID / (TERRAIN_CHUNK_SIZE + 1)^2.
+void terrain_draw_queued_chunks();
+
+// Rasterises the chunk's terraces, which must have been generated
+void terrain_rasterise_chunk_occluder(const TerrainChunk* chunk, OcclusionBuffer* buffer);
+
+// Maps the staging ring, so call it on the GL thread after choosing the vertex format
+void terrain_generator_init(TerrainGenerator* out, int numThreads);
+
+void terrain_generator_destroy(TerrainGenerator* generator);
+
+// Queues the chunk for generation; its mesh becomes ready once uploaded by terrain_generator_upload_one
+void terrain_generator_request(TerrainGenerator* generator, TerrainChunk* chunk);
+
+// Uploads one finished chunk (or discards it if the chunk has since been re-requested), returns FALSE
+// if none were waiting. outLatency, if not NULL, is set to the seconds from the chunk's request to its
+// upload, or to -1 if nothing was uploaded.
+int terrain_generator_upload_one(TerrainGenerator* generator, double* outLatency);
+
+// Fences this frame's uploads and reclaims the staging memory of those the GPU has finished copying.
+// Call once per frame after the last terrain_generator_upload_one.
+void terrain_generator_end_frame(TerrainGenerator* generator);
+
+void terrain_chunk_grid_init(TerrainChunkGrid* out, int radius);
+
+// Destroy the generator first so no job still refers to the grid's chunks
+void terrain_chunk_grid_destroy(TerrainChunkGrid* grid);
+
+// Refreshes the bounds arrays from the chunks' current coordinates and generated heights
+void terrain_chunk_grid_update_bounds(TerrainChunkGrid* grid);
+
+// Picks the coarsest LOD for each chunk whose error, projected to the screen, stays under a pixel
+// threshold. errorScale is viewportHeight / (2 * tan(vfov / 2) * maxPixelError). Neighbouring chunks
+// are kept within one LOD of each other and stitched along their shared edges.
+void terrain_chunk_grid_select_lods(TerrainChunkGrid* grid, float cameraX, float cameraY, float cameraZ, float errorScale);
+
+// Centres the grid on the chunk containing (worldX, worldZ) and requests every chunk that came into range
+void terrain_chunk_grid_update(TerrainChunkGrid* grid, TerrainGenerator* generator, float worldX, float worldZ);
+
 #endif
\ No newline at end of file